@@ -0,0 +1,27 @@
+#include "lock_harness.cl"
+
+// Spins without touching global memory; the counter is volatile so the loop isn't folded away
+static void backoff(uint delay) {
+    volatile uint spin = 0;
+    while (spin < delay)
+        spin++;
+}
+
+// After each lost exchange the delay doubles, from params[0] up to params[1]
+static uint lock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    uint retries = 0;
+    uint delay = params[0];
+    while(1) {
+        while(atomic_load_explicit(l, memory_order_relaxed))
+            retries++;
+        if (!atomic_exchange_explicit(l, 1, LOCK_ACQUIRE))
+            return retries;
+        retries++;
+        backoff(delay);
+        delay = min(delay * 2, params[1]);
+    }
+}
+
+static void unlock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    atomic_store_explicit(l, 0, LOCK_RELEASE);
+}
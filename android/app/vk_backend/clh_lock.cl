@@ -0,0 +1,20 @@
+#include "lock_harness.cl"
+
+// state[0] is the initially free dummy node and contender me starts out owning state[me + 1].
+// l holds the index of the tail node, so zeroing it points the queue at the dummy. A waiter spins
+// on its predecessor's flag (kept in node->y) and then adopts that node for its next acquisition.
+// Swapping the tail always uses acq_rel, which keeps the queue intact; LOCK_ORDER applies to the handoff.
+static uint lock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    uint retries = 0;
+    atomic_store_explicit(&state[node->x], 1, memory_order_relaxed);
+    uint pred = atomic_exchange_explicit(l, node->x, memory_order_acq_rel);
+    while (atomic_load_explicit(&state[pred], LOCK_ACQUIRE))
+        retries++;
+    node->y = pred;
+    return retries;
+}
+
+static void unlock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    atomic_store_explicit(&state[node->x], 0, LOCK_RELEASE);
+    node->x = node->y;
+}
@@ -1,8 +1,14 @@
 #include <vector>
 #include <array>
+#include <algorithm>
 #include <fstream>
 #include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <stdarg.h>
+#include <cstdio>
+#include <cstring>
 
 #include "easyvk.h"
 
@@ -23,6 +29,8 @@ void evk_log(const char* fmt, ...) {
 
 bool printDeviceInfo = false;
 
+std::string pipelineCacheDir;
+
 // Would use string_VkResult() for this but vk_enum_string_helper.h is no more...
 inline const char* vkResultString(VkResult res) {
 	switch(res) {
@@ -106,6 +114,25 @@ namespace easyvk {
 		enabledExtensions.push_back("VK_KHR_portability_enumeration");
 		#endif
 
+		// A 1.0 loader rejects instances that ask for 1.1, and only has vkEnumerateInstanceVersion from 1.1 on
+		auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+		uint32_t loaderVersion = VK_API_VERSION_1_0;
+		if (enumerateInstanceVersion != nullptr)
+			enumerateInstanceVersion(&loaderVersion);
+		apiVersion = loaderVersion >= VK_API_VERSION_1_1 ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
+
+		// Lets probeCapabilities query devices that only report 1.0
+		uint32_t extensionCount;
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> instanceExtensions(extensionCount);
+		vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, instanceExtensions.data());
+		for (auto& extension : instanceExtensions) {
+			if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+				enabledExtensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+				properties2Extension = true;
+			}
+		}
+
 		// Define app information
 		VkApplicationInfo appInfo {
 		    VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -114,7 +141,7 @@ namespace easyvk {
 		    0,
 		    "Heterogeneous Programming Group",
 		    0,
-		    VK_API_VERSION_1_1
+		    apiVersion
 		};
 		
 		#ifdef __APPLE__
@@ -170,7 +197,7 @@ namespace easyvk {
 		}
 	}
 
-	std::vector<easyvk::Device> Instance::devices() {
+	std::vector<easyvk::PhysicalDeviceInfo> Instance::physicalDevices() {
 	    // Get physical device count
 		uint32_t deviceCount = 0;
 		vkCheck(vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr));
@@ -179,12 +206,37 @@ namespace easyvk {
 		std::vector<VkPhysicalDevice> physicalDevices(deviceCount);
 		vkCheck(vkEnumeratePhysicalDevices(instance, &deviceCount, physicalDevices.data()));
 
-		// Store devices in vector
-		auto devices = std::vector<easyvk::Device>{};
-		for (auto device : physicalDevices) {
-			devices.push_back(easyvk::Device(*this, device));
+		// Only properties are queried here; logical devices are created on selection
+		auto infos = std::vector<easyvk::PhysicalDeviceInfo>{};
+		for (uint32_t i = 0; i < deviceCount; i++) {
+			easyvk::PhysicalDeviceInfo info {i, physicalDevices[i]};
+			vkGetPhysicalDeviceProperties(physicalDevices[i], &info.properties);
+			infos.push_back(info);
 		}
-		return devices;
+		return infos;
+	}
+
+	easyvk::Device Instance::selectDevice(uint32_t index) {
+		auto infos = physicalDevices();
+		if (index >= infos.size())
+			throw std::runtime_error("no physical device with index " + std::to_string(index));
+		return easyvk::Device(*this, infos[index].physicalDevice);
+	}
+
+	easyvk::Device Instance::selectDevice(const std::string &nameSubstring) {
+		for (auto &info : physicalDevices()) {
+			if (std::string(info.properties.deviceName).find(nameSubstring) != std::string::npos)
+				return easyvk::Device(*this, info.physicalDevice);
+		}
+		throw std::runtime_error("no physical device name contains '" + nameSubstring + "'");
+	}
+
+	easyvk::Device Instance::selectDevice(VkPhysicalDeviceType type) {
+		for (auto &info : physicalDevices()) {
+			if (info.properties.deviceType == type)
+				return easyvk::Device(*this, info.physicalDevice);
+		}
+		throw std::runtime_error(std::string("no physical device of type ") + vkDeviceType(type));
 	}
 
 	void Instance::teardown() {
@@ -199,6 +251,10 @@ namespace easyvk {
 		vkDestroyInstance(instance, nullptr);
 	}
 
+	void setPipelineCacheDir(const std::string &dir) {
+		pipelineCacheDir = dir;
+	}
+
 	uint32_t getComputeFamilyId(VkPhysicalDevice physicalDevice) {
 		// Get queue family count
 		uint32_t queueFamilyPropertyCount = 0;
@@ -221,6 +277,106 @@ namespace easyvk {
 		return computeFamilyId;
 	}
 
+	uint32_t getTimestampValidBits(VkPhysicalDevice physicalDevice, uint32_t familyId) {
+		uint32_t queueFamilyPropertyCount = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropertyCount, nullptr);
+
+		std::vector<VkQueueFamilyProperties> familyProperties(queueFamilyPropertyCount);
+		vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyPropertyCount, familyProperties.data());
+
+		if (familyId >= queueFamilyPropertyCount)
+			return 0;
+		return familyProperties[familyId].timestampValidBits;
+	}
+
+	PFN_vkVoidFunction Instance::procAddr(const char* name) {
+		return vkGetInstanceProcAddr(instance, name);
+	}
+
+	Capabilities probeCapabilities(Instance &instance, VkPhysicalDevice physicalDevice, uint32_t computeFamilyId) {
+		Capabilities capabilities;
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+		capabilities.apiVersion = properties.apiVersion;
+		capabilities.timestampValidBits = getTimestampValidBits(physicalDevice, computeFamilyId);
+		capabilities.timestampPeriod = properties.limits.timestampPeriod;
+
+		// The *2 queries aren't exported by every loader (the NDK's libvulkan at API 26 lacks them) and are only
+		// valid on 1.1 devices, so they are looked up: core on 1.1, the KHR extension's on 1.0
+		bool core11 = instance.apiVersion >= VK_API_VERSION_1_1 && properties.apiVersion >= VK_API_VERSION_1_1;
+		PFN_vkGetPhysicalDeviceFeatures2 getFeatures2 = nullptr;
+		PFN_vkGetPhysicalDeviceProperties2 getProperties2 = nullptr;
+		if (core11) {
+			getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2)instance.procAddr("vkGetPhysicalDeviceFeatures2");
+			getProperties2 = (PFN_vkGetPhysicalDeviceProperties2)instance.procAddr("vkGetPhysicalDeviceProperties2");
+		} else if (instance.properties2Extension) {
+			getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2)instance.procAddr("vkGetPhysicalDeviceFeatures2KHR");
+			getProperties2 = (PFN_vkGetPhysicalDeviceProperties2)instance.procAddr("vkGetPhysicalDeviceProperties2KHR");
+		}
+		if (getFeatures2 == nullptr || getProperties2 == nullptr)
+			return capabilities;
+
+		uint32_t count;
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, nullptr);
+		std::vector<VkExtensionProperties> extensions(count);
+		vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, extensions.data());
+		auto hasExtension = [&](const char* name) {
+			for (auto& extension : extensions) {
+				if (strcmp(extension.extensionName, name) == 0)
+					return true;
+			}
+			return false;
+		};
+
+		// Feature structs may only be chained for extensions the device has
+		void* chain = nullptr;
+		VkPhysicalDeviceVulkanMemoryModelFeaturesKHR memoryModelFeatures {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_MEMORY_MODEL_FEATURES_KHR};
+		if (hasExtension(VK_KHR_VULKAN_MEMORY_MODEL_EXTENSION_NAME)) {
+			memoryModelFeatures.pNext = chain;
+			chain = &memoryModelFeatures;
+		}
+		VkPhysicalDeviceShaderClockFeaturesKHR clockFeatures {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR};
+		if (hasExtension(VK_KHR_SHADER_CLOCK_EXTENSION_NAME)) {
+			clockFeatures.pNext = chain;
+			chain = &clockFeatures;
+		}
+		VkPhysicalDeviceShaderAtomicInt64Features atomicInt64Features {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_ATOMIC_INT64_FEATURES};
+		if (hasExtension(VK_KHR_SHADER_ATOMIC_INT64_EXTENSION_NAME)) {
+			atomicInt64Features.pNext = chain;
+			chain = &atomicInt64Features;
+		}
+		VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES};
+		if (hasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME)) {
+			timelineFeatures.pNext = chain;
+			chain = &timelineFeatures;
+		}
+		VkPhysicalDeviceBufferDeviceAddressFeatures addressFeatures {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES};
+		if (hasExtension(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME)) {
+			addressFeatures.pNext = chain;
+			chain = &addressFeatures;
+		}
+		VkPhysicalDeviceFeatures2 features2 {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, chain};
+		getFeatures2(physicalDevice, &features2);
+
+		// Subgroup properties are core 1.1, so a 1.0 device leaves them unknown
+		VkPhysicalDeviceSubgroupProperties subgroupProperties {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES};
+		VkPhysicalDeviceProperties2 properties2 {VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, core11 ? &subgroupProperties : nullptr};
+		getProperties2(physicalDevice, &properties2);
+
+		capabilities.vulkanMemoryModel = memoryModelFeatures.vulkanMemoryModel;
+		capabilities.vulkanMemoryModelDeviceScope = memoryModelFeatures.vulkanMemoryModelDeviceScope;
+		capabilities.subgroupSize = subgroupProperties.subgroupSize;
+		capabilities.subgroupCompute = subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT;
+		capabilities.subgroupOperations = subgroupProperties.supportedOperations;
+		capabilities.shaderSubgroupClock = clockFeatures.shaderSubgroupClock;
+		capabilities.shaderDeviceClock = clockFeatures.shaderDeviceClock;
+		capabilities.shaderBufferInt64Atomics = atomicInt64Features.shaderBufferInt64Atomics;
+		capabilities.timelineSemaphore = timelineFeatures.timelineSemaphore;
+		capabilities.bufferDeviceAddress = addressFeatures.bufferDeviceAddress;
+		return capabilities;
+	}
+
 	Device::Device(easyvk::Instance &_instance, VkPhysicalDevice _physicalDevice) :
 		instance(_instance),
 		physicalDevice(_physicalDevice),
@@ -239,56 +395,66 @@ namespace easyvk {
 				&priority
 			};
 
-			// Get device's enabled extensions
-			uint32_t count;
-			vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, nullptr);
-			std::vector<VkExtensionProperties> extensions(count);
-			vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, extensions.data());
-			bool vulkan_memory_model_supported = false;
+			capabilities = probeCapabilities(instance, physicalDevice, computeFamilyId);
 
-			for (auto& extension : extensions) {
-				std::string name(extension.extensionName);
-				if(name == "VK_KHR_vulkan_memory_model") {
-					vulkan_memory_model_supported = true;
-				}
-			}
-
-			// Define device info
+			// Chain a features struct, and enable the extension, for each optional feature that is present
 			std::vector<const char*> enabledExtensions { };
+			void* features = nullptr;
 
-			VkDeviceCreateInfo deviceCreateInfo;
-			if(vulkan_memory_model_supported) {
-				deviceCreateInfo = {
-					VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-					new VkPhysicalDeviceVulkanMemoryModelFeaturesKHR {
-						VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_MEMORY_MODEL_FEATURES_KHR,
-						nullptr,
-						true,
-						true,
-					},
-					VkDeviceCreateFlags {},
-					1,
-					queues.data(),
-					0,
-					nullptr,
-					(uint32_t)enabledExtensions.size(),
-					enabledExtensions.data()
-				};
+			VkPhysicalDeviceVulkanMemoryModelFeaturesKHR memoryModelFeatures {
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_MEMORY_MODEL_FEATURES_KHR, features,
+				capabilities.vulkanMemoryModel, capabilities.vulkanMemoryModelDeviceScope, false
+			};
+			// Device scope is enabled alongside the model; ordered lock variants use device-scope atomics
+			if (capabilities.vulkanMemoryModel) {
+				enabledExtensions.push_back(VK_KHR_VULKAN_MEMORY_MODEL_EXTENSION_NAME);
+				features = &memoryModelFeatures;
 			}
-			else {
-				deviceCreateInfo = {
-					VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-					nullptr,
-					VkDeviceCreateFlags{},
-					1,
-					queues.data(),
-					0,
-					nullptr,
-					(uint32_t)enabledExtensions.size(),
-					enabledExtensions.data()
-				};
+			VkPhysicalDeviceShaderClockFeaturesKHR clockFeatures {
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_CLOCK_FEATURES_KHR, features,
+				capabilities.shaderSubgroupClock, capabilities.shaderDeviceClock
+			};
+			if (capabilities.shaderSubgroupClock || capabilities.shaderDeviceClock) {
+				enabledExtensions.push_back(VK_KHR_SHADER_CLOCK_EXTENSION_NAME);
+				features = &clockFeatures;
+			}
+			VkPhysicalDeviceShaderAtomicInt64Features atomicInt64Features {
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_ATOMIC_INT64_FEATURES, features,
+				capabilities.shaderBufferInt64Atomics, false
+			};
+			if (capabilities.shaderBufferInt64Atomics) {
+				enabledExtensions.push_back(VK_KHR_SHADER_ATOMIC_INT64_EXTENSION_NAME);
+				features = &atomicInt64Features;
+			}
+			VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures {
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES, features,
+				capabilities.timelineSemaphore
+			};
+			if (capabilities.timelineSemaphore) {
+				enabledExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+				features = &timelineFeatures;
+			}
+			VkPhysicalDeviceBufferDeviceAddressFeatures addressFeatures {
+				VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_BUFFER_DEVICE_ADDRESS_FEATURES, features,
+				capabilities.bufferDeviceAddress, false, false
+			};
+			if (capabilities.bufferDeviceAddress) {
+				enabledExtensions.push_back(VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME);
+				features = &addressFeatures;
 			}
 
+			VkDeviceCreateInfo deviceCreateInfo {
+				VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+				features,
+				VkDeviceCreateFlags {},
+				1,
+				queues.data(),
+				0,
+				nullptr,
+				(uint32_t)enabledExtensions.size(),
+				enabledExtensions.data()
+			};
+
 			// Create device
 			vkCheck(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device));
 
@@ -303,21 +469,96 @@ namespace easyvk {
 			// Create command pool
 			vkCheck(vkCreateCommandPool(device, &commandPoolCreateInfo, nullptr, &computePool));
 
-			// Define command buffer info
-			VkCommandBufferAllocateInfo commandBufferAI {
-				VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-				nullptr,
-				computePool,
-				VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-				1
-			};
-
-			// Allocate command buffers
-			vkCheck(vkAllocateCommandBuffers(device, &commandBufferAI, &computeCommandBuffer));
-			
 			// Get device properties
 			vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+			arena = easyvk::Arena(device, physicalDevice, properties.limits.minStorageBufferOffsetAlignment,
+								  properties.limits.nonCoherentAtomSize);
+
+			loadPipelineCache();
+		}
+
+	// Cache files are keyed by everything that can invalidate a driver's pipeline cache
+	std::string Device::pipelineCachePath() {
+		if (pipelineCacheDir.empty())
+			return "";
+		char key[64];
+		snprintf(key, sizeof(key), "pipeline_cache_%08x_%08x_%08x_",
+				 properties.vendorID, properties.deviceID, properties.driverVersion);
+		std::string path = pipelineCacheDir + "/" + key;
+		for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+			char hex[3];
+			snprintf(hex, sizeof(hex), "%02x", properties.pipelineCacheUUID[i]);
+			path += hex;
+		}
+		return path + ".bin";
+	}
+
+	void Device::loadPipelineCache() {
+		std::vector<char> data;
+		std::string path = pipelineCachePath();
+		if (!path.empty()) {
+			std::ifstream fin(path, std::ios::binary | std::ios::ate);
+			if (fin.is_open()) {
+				data.resize(size_t(fin.tellg()));
+				fin.seekg(0);
+				fin.read(data.data(), data.size());
+				if (!fin)
+					data.clear();
+			}
+		}
+
+		// Drivers should reject mismatched blobs themselves, but not all do, so check the header first
+		if (data.size() >= sizeof(VkPipelineCacheHeaderVersionOne)) {
+			VkPipelineCacheHeaderVersionOne header;
+			memcpy(&header, data.data(), sizeof(header));
+			pipelineCacheHit = header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+				&& header.vendorID == properties.vendorID
+				&& header.deviceID == properties.deviceID
+				&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+		}
+		if (!pipelineCacheHit)
+			data.clear();
+
+		VkPipelineCacheCreateInfo cacheCreateInfo {
+			VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+			nullptr,
+			VkPipelineCacheCreateFlags {},
+			data.size(),
+			data.empty() ? nullptr : data.data()
+		};
+		vkCheck(vkCreatePipelineCache(device, &cacheCreateInfo, nullptr, &pipelineCache));
+	}
+
+	void Device::syncPipelineCache() {
+		if (pipelineCacheChanged)
+			savePipelineCache();
+	}
+
+	void Device::savePipelineCache() {
+		pipelineCacheChanged = false;
+		std::string path = pipelineCachePath();
+		if (path.empty())
+			return;
+
+		size_t size = 0;
+		vkCheck(vkGetPipelineCacheData(device, pipelineCache, &size, nullptr));
+		std::vector<char> data(size);
+		vkCheck(vkGetPipelineCacheData(device, pipelineCache, &size, data.data()));
+
+		// Write to a temporary file and rename, so an interrupted save never leaves a truncated cache
+		std::string tmpPath = path + ".tmp";
+		std::ofstream fout(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!fout.is_open()) {
+			evk_log("Could not write pipeline cache to %s\n", tmpPath.c_str());
+			return;
+		}
+		fout.write(data.data(), size);
+		fout.close();
+		if (!fout || rename(tmpPath.c_str(), path.c_str()) != 0) {
+			evk_log("Could not write pipeline cache to %s\n", path.c_str());
+			remove(tmpPath.c_str());
 		}
+	}
 
 	uint32_t Device::selectMemory(VkBuffer buffer, VkMemoryPropertyFlags flags) {
 		VkPhysicalDeviceMemoryProperties memProperties;
@@ -336,6 +577,107 @@ namespace easyvk {
 		return uint32_t(-1);
 	}
 
+	// Hand out a command buffer from the pool, reusing released ones before allocating
+	VkCommandBuffer Device::acquireCommandBuffer() {
+		if (!freeCommandBuffers.empty()) {
+			VkCommandBuffer commandBuffer = freeCommandBuffers.back();
+			freeCommandBuffers.pop_back();
+			return commandBuffer;
+		}
+
+		// Define command buffer info
+		VkCommandBufferAllocateInfo commandBufferAI {
+			VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			nullptr,
+			computePool,
+			VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			1
+		};
+
+		// Allocate command buffer
+		VkCommandBuffer commandBuffer;
+		vkCheck(vkAllocateCommandBuffers(device, &commandBufferAI, &commandBuffer));
+		return commandBuffer;
+	}
+
+	// Return a command buffer that is no longer pending, resetting it for the next owner
+	void Device::releaseCommandBuffer(VkCommandBuffer commandBuffer) {
+		vkCheck(vkResetCommandBuffer(commandBuffer, 0));
+		freeCommandBuffers.push_back(commandBuffer);
+	}
+
+	void Device::runCommands(const std::function<void(VkCommandBuffer)> &record) {
+		VkCommandBuffer commandBuffer = acquireCommandBuffer();
+		VkCommandBufferBeginInfo beginInfo {
+			VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+			nullptr,
+			VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+		};
+		vkCheck(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+		record(commandBuffer);
+		vkCheck(vkEndCommandBuffer(commandBuffer));
+
+		VkFence fence;
+		VkFenceCreateInfo fenceCreateInfo {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, VkFenceCreateFlags {}};
+		vkCheck(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
+		VkSubmitInfo submitInfo {
+			VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			nullptr,
+			0,
+			nullptr,
+			nullptr,
+			1,
+			&commandBuffer,
+			0,
+			nullptr
+		};
+		vkCheck(vkQueueSubmit(computeQueue(), 1, &submitInfo, fence));
+		vkCheck(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+		vkDestroyFence(device, fence, nullptr);
+		releaseCommandBuffer(commandBuffer);
+	}
+
+	// Tries each acceptable set of property flags in order of preference
+	uint32_t Device::selectMemory(VkBuffer buffer, easyvk::MemoryPolicy policy) {
+		const VkMemoryPropertyFlags deviceLocal = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		const VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		const VkMemoryPropertyFlags hostCoherent = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		const VkMemoryPropertyFlags hostCached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+		std::vector<VkMemoryPropertyFlags> candidates;
+		switch (policy) {
+			case MemoryPolicy::DeviceLocal:
+				candidates = {deviceLocal};
+				break;
+			case MemoryPolicy::HostCoherent:
+				candidates = {hostCoherent};
+				break;
+			case MemoryPolicy::HostCached:
+				candidates = {hostCached | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, hostCached, hostVisible};
+				break;
+			case MemoryPolicy::Auto:
+			default:
+				candidates = {deviceLocal | hostCoherent};
+				if (properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+					candidates.push_back(deviceLocal);
+				candidates.push_back(hostCoherent);
+				candidates.push_back(hostVisible);
+				break;
+		}
+		for (auto flags : candidates) {
+			uint32_t memoryType = selectMemory(buffer, flags);
+			if (memoryType != uint32_t(-1))
+				return memoryType;
+		}
+		return selectMemory(buffer, 0);
+	}
+
+	VkMemoryPropertyFlags Device::memoryTypeFlags(uint32_t memoryType) {
+		VkPhysicalDeviceMemoryProperties memProperties;
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+		return memProperties.memoryTypes[memoryType].propertyFlags;
+	}
+
 	// Get device queue
 	VkQueue Device::computeQueue() {
 		VkQueue queue;
@@ -344,6 +686,9 @@ namespace easyvk {
 	}
 
 	void Device::teardown() {
+		savePipelineCache();
+		vkDestroyPipelineCache(device, pipelineCache, nullptr);
+		arena.teardown();
 	    vkDestroyCommandPool(device, computePool, nullptr);
 		vkDestroyDevice(device, nullptr);
 	}
@@ -356,39 +701,224 @@ namespace easyvk {
 			nullptr,
 			VkBufferCreateFlags {},
 			size * sizeof(uint32_t),
-			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT }, nullptr, &newBuffer));
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT }, nullptr, &newBuffer));
 		return newBuffer;
 	}
 
-	Buffer::Buffer(easyvk::Device &_device, uint32_t _size) :
+	// Default size of each arena block; requests larger than this get a block of their own
+	const VkDeviceSize arenaBlockSize = 4 * 1024 * 1024;
+
+	VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	Arena::Arena(VkDevice _device, VkPhysicalDevice physicalDevice, VkDeviceSize _minAlignment, VkDeviceSize _nonCoherentAtomSize) :
+		device(_device),
+		minAlignment(_minAlignment > 0 ? _minAlignment : 1),
+		nonCoherentAtomSize(_nonCoherentAtomSize > 0 ? _nonCoherentAtomSize : 1) {
+		vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	}
+
+	bool Arena::allocateFrom(Block &block, uint32_t index, VkDeviceSize size, VkDeviceSize alignment, Allocation &allocation) {
+		for (size_t r = 0; r < block.freeRanges.size(); r++) {
+			VkDeviceSize rangeStart = block.freeRanges[r].first;
+			VkDeviceSize rangeEnd = rangeStart + block.freeRanges[r].second;
+			VkDeviceSize start = alignUp(rangeStart, alignment);
+			if (start + size > rangeEnd)
+				continue;
+
+			// Carve the slice out, keeping whatever is left on either side of it
+			block.freeRanges.erase(block.freeRanges.begin() + r);
+			if (start + size < rangeEnd)
+				block.freeRanges.insert(block.freeRanges.begin() + r, {start + size, rangeEnd - start - size});
+			if (start > rangeStart)
+				block.freeRanges.insert(block.freeRanges.begin() + r, {rangeStart, start - rangeStart});
+
+			allocation.memory = block.memory;
+			allocation.offset = start;
+			allocation.size = size;
+			allocation.block = index;
+			allocation.mapped = block.mapped ? (char*)block.mapped + start : nullptr;
+			return true;
+		}
+		return false;
+	}
+
+	Allocation Arena::allocate(VkMemoryRequirements requirements, uint32_t memoryType) {
+		VkDeviceSize alignment = std::max(requirements.alignment, minAlignment);
+		// Flushes and invalidates of non-coherent memory work in whole atoms, so slices must not share one
+		if (!(memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+			alignment = std::max(alignment, nonCoherentAtomSize);
+			requirements.size = alignUp(requirements.size, nonCoherentAtomSize);
+		}
+		Allocation allocation;
+		for (uint32_t i = 0; i < blocks.size(); i++) {
+			if (blocks[i].memoryType == memoryType && allocateFrom(blocks[i], i, requirements.size, alignment, allocation))
+				return allocation;
+		}
+
+		// No room in existing blocks, so grow the arena by one block of this memory type
+		Block block;
+		block.memoryType = memoryType;
+		block.size = std::max(arenaBlockSize, alignUp(requirements.size, alignment));
+		block.mapped = nullptr;
+		VkMemoryAllocateInfo allocateInfo {
+			VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			nullptr,
+			block.size,
+			memoryType
+		};
+		vkCheck(vkAllocateMemory(device, &allocateInfo, nullptr, &block.memory));
+
+		// Host-visible blocks stay persistently mapped for their whole lifetime
+		if (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+			vkCheck(vkMapMemory(device, block.memory, 0, VK_WHOLE_SIZE, VkMemoryMapFlags {}, &block.mapped));
+		block.freeRanges.push_back({0, block.size});
+		blocks.push_back(block);
+
+		allocateFrom(blocks.back(), blocks.size() - 1, requirements.size, alignment, allocation);
+		return allocation;
+	}
+
+	void Arena::free(const Allocation &allocation) {
+		auto &ranges = blocks[allocation.block].freeRanges;
+		auto pos = std::lower_bound(ranges.begin(), ranges.end(), std::make_pair(allocation.offset, VkDeviceSize(0)));
+		pos = ranges.insert(pos, {allocation.offset, allocation.size});
+
+		// Merge with the following and preceding ranges if they touch
+		auto next = pos + 1;
+		if (next != ranges.end() && pos->first + pos->second == next->first) {
+			pos->second += next->second;
+			ranges.erase(next);
+		}
+		if (pos != ranges.begin()) {
+			auto prev = pos - 1;
+			if (prev->first + prev->second == pos->first) {
+				prev->second += pos->second;
+				ranges.erase(pos);
+			}
+		}
+	}
+
+	uint32_t Arena::blockCount() {
+		return blocks.size();
+	}
+
+	void Arena::teardown() {
+		for (auto &block : blocks) {
+			if (block.mapped)
+				vkUnmapMemory(device, block.memory);
+			vkFreeMemory(device, block.memory, nullptr);
+		}
+		blocks.clear();
+	}
+
+	Buffer::Buffer(easyvk::Device &_device, uint32_t _size, easyvk::MemoryPolicy policy) :
 		device(_device),
 		buffer(getNewBuffer(_device, _size)),
 		size(_size)
 		{
-            // Allocate and map memory to new buffer
-	        auto memId = _device.selectMemory(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+            // Sub-allocate from the device's arena and bind the buffer at its slice
+	        auto memId = _device.selectMemory(buffer, policy);
+            flags = _device.memoryTypeFlags(memId);
 
             VkMemoryRequirements memReqs;
             vkGetBufferMemoryRequirements(device.device, buffer, &memReqs);
 
-            vkCheck(vkAllocateMemory(_device.device, new VkMemoryAllocateInfo {
-                VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-                nullptr,
-                memReqs.size,
-                memId}, nullptr, &memory));
+            allocation = _device.arena.allocate(memReqs, memId);
+            vkCheck(vkBindBufferMemory(_device.device, buffer, allocation.memory, allocation.offset));
 
-            vkCheck(vkBindBufferMemory(_device.device, buffer, memory, 0));
+            // Memory the host can't map is read and written through a cached staging buffer, made by createStaging()
+            if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+                data = (uint32_t*)allocation.mapped;
+		}
 
-            void* newData = new void*;
-            vkCheck(vkMapMemory(_device.device, memory, 0, VK_WHOLE_SIZE, VkMemoryMapFlags {}, &newData));
-            data = (uint32_t*)newData;
+	// Most device-local buffers are never touched by the host, so their staging copy waits for the first access
+	void Buffer::createStaging() {
+		staging = std::make_shared<easyvk::Buffer>(device, size, MemoryPolicy::HostCached);
+		data = staging->data;
+	}
+
+	void Buffer::recordCopy(VkCommandBuffer commandBuffer, easyvk::Buffer &src, easyvk::Buffer &dst, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+		VkBufferCopy region {0, 0, size * sizeof(uint32_t)};
+		vkCmdCopyBuffer(commandBuffer, src.buffer, dst.buffer, 1, &region);
+		VkBufferMemoryBarrier copyBarrier {
+			VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			nullptr,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			dstAccess,
+			VK_QUEUE_FAMILY_IGNORED,
+			VK_QUEUE_FAMILY_IGNORED,
+			dst.buffer,
+			0,
+			VK_WHOLE_SIZE
+		};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 0, nullptr, 1, &copyBarrier, 0, nullptr);
+	}
+
+	void Buffer::flush() {
+		if (staged()) {
+			if (!staging)
+				createStaging();
+			staging->flush();
+			device.runCommands([this](VkCommandBuffer commandBuffer) {
+				recordCopy(commandBuffer, *staging, *this, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+						   VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT);
+			});
+		} else if (!(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+			VkMappedMemoryRange range {VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, allocation.memory, allocation.offset, allocation.size};
+			vkCheck(vkFlushMappedMemoryRanges(device.device, 1, &range));
 		}
+	}
 
+	void Buffer::invalidate() {
+		if (staged()) {
+			if (!staging)
+				createStaging();
+			device.runCommands([this](VkCommandBuffer commandBuffer) {
+				recordCopy(commandBuffer, *this, *staging, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+			});
+			staging->invalidate();
+		} else if (!(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+			VkMappedMemoryRange range {VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, allocation.memory, allocation.offset, allocation.size};
+			vkCheck(vkInvalidateMappedMemoryRanges(device.device, 1, &range));
+		}
+	}
+
+	void Buffer::clear() {
+		if (!(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+			device.runCommands([this](VkCommandBuffer commandBuffer) {
+				recordFill(commandBuffer, 0);
+			});
+			return;
+		}
+		for (uint32_t i = 0; i < size; i++)
+			store(i, 0);
+		flush();
+	}
+
+	void Buffer::recordFill(VkCommandBuffer commandBuffer, uint32_t value) {
+		vkCmdFillBuffer(commandBuffer, buffer, 0, VK_WHOLE_SIZE, value);
+		VkBufferMemoryBarrier fillBarrier {
+			VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+			nullptr,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_QUEUE_FAMILY_IGNORED,
+			VK_QUEUE_FAMILY_IGNORED,
+			buffer,
+			0,
+			VK_WHOLE_SIZE
+		};
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+							 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &fillBarrier, 0, nullptr);
+	}
 
 	void Buffer::teardown() {
-		vkUnmapMemory(device.device, memory);
-		vkFreeMemory(device.device, memory, nullptr);
+		if (staging)
+			staging->teardown();
 		vkDestroyBuffer(device.device, buffer, nullptr);
+		device.arena.free(allocation);
 	}
 
 	// Read spv shader files
@@ -483,56 +1013,113 @@ namespace easyvk {
 	}
 
 	void Program::prepare() {
-		VkSpecializationMapEntry specMap[1] = {VkSpecializationMapEntry{0, 0, sizeof(uint32_t)}};
-		uint32_t specMapContent[1] = {workgroupSize};
-		VkSpecializationInfo specInfo {1, specMap, sizeof(uint32_t), specMapContent};
-		// Define shader stage create info
-		VkPipelineShaderStageCreateInfo stageCI{
-			VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-			nullptr,
-			VkPipelineShaderStageCreateFlags {},
-			VK_SHADER_STAGE_COMPUTE_BIT,
-			shaderModule,
-			"lock_test",
-			&specInfo};
-		// Define compute pipeline create info
-		VkComputePipelineCreateInfo pipelineCI{
-			VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-			nullptr,
-			{},
-			stageCI,
-			pipelineLayout
-		};
-
-		// Create compute pipelines
-		vkCheck(vkCreateComputePipelines(device.device, {}, 1, &pipelineCI, nullptr,  &pipeline));
+		// Push-constant ranges are part of the pipeline layout, so a new size replaces the layout and the pipeline
+		if (pipelineLayout == VK_NULL_HANDLE || layoutPushConstantBytes != pushConstants.size()) {
+			if (pipeline != VK_NULL_HANDLE) {
+				vkDestroyPipeline(device.device, pipeline, nullptr);
+				pipeline = VK_NULL_HANDLE;
+			}
+			createPipelineLayout();
+		}
 
-		// Start recording command buffer
-		vkCheck(vkBeginCommandBuffer(device.computeCommandBuffer, new VkCommandBufferBeginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO}));
+		// A pipeline survives changes to the dispatch count or iterations; only new specialization constants rebuild it.
+		// Entries keep their order and size once set, so equal data means equal constants.
+		if (pipeline == VK_NULL_HANDLE || pipelineSpecData != specData) {
+			VkSpecializationInfo specInfo {(uint32_t)specEntries.size(), specEntries.data(), specData.size(), specData.data()};
+			// Define shader stage create info
+			VkPipelineShaderStageCreateInfo stageCI{
+				VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+				nullptr,
+				VkPipelineShaderStageCreateFlags {},
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				shaderModule,
+				entryPoint.c_str(),
+				&specInfo};
+			// Define compute pipeline create info
+			VkComputePipelineCreateInfo pipelineCI{
+				VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+				nullptr,
+				{},
+				stageCI,
+				pipelineLayout
+			};
 
-		// Bind pipeline and descriptor sets
-		vkCmdBindPipeline(device.computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
-		vkCmdBindDescriptorSets(device.computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-						  pipelineLayout, 0, 1, &descriptorSet, 0, 0);
+			// Create compute pipelines, replacing the one from any earlier prepare()
+			if (pipeline != VK_NULL_HANDLE)
+				vkDestroyPipeline(device.device, pipeline, nullptr);
+			vkCheck(vkCreateComputePipelines(device.device, device.pipelineCache, 1, &pipelineCI, nullptr,  &pipeline));
+			device.pipelineCacheChanged = true;
+			pipelineSpecData = specData;
+		}
 
-		// Bind push constants
-		uint32_t pValues[3] = {0, 0, 0};
-		vkCmdPushConstants(device.computeCommandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, easyvk::push_constant_size_bytes, &pValues);
+		// Two timestamps per dispatch, if the compute queue supports them
+		if (queryPool != VK_NULL_HANDLE && queryPoolIterations != iterations) {
+			vkDestroyQueryPool(device.device, queryPool, nullptr);
+			queryPool = VK_NULL_HANDLE;
+		}
+		if (queryPool == VK_NULL_HANDLE && device.capabilities.timestampValidBits > 0) {
+			VkQueryPoolCreateInfo queryPoolCI {
+				VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+				nullptr,
+				VkQueryPoolCreateFlags {},
+				VK_QUERY_TYPE_TIMESTAMP,
+				2 * iterations,
+				0
+			};
+			vkCheck(vkCreateQueryPool(device.device, &queryPoolCI, nullptr, &queryPool));
+			queryPoolIterations = iterations;
+		}
 
-        vkCmdPipelineBarrier(device.computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
-                             1, new VkMemoryBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT}, 0, {}, 0, {});
+		// Start recording this program's command buffer; begin implicitly resets anything recorded earlier
+		vkCheck(vkBeginCommandBuffer(commandBuffer, new VkCommandBufferBeginInfo {VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO}));
+		if (queryPool != VK_NULL_HANDLE)
+			vkCmdResetQueryPool(commandBuffer, queryPool, 0, 2 * iterations);
 
-		// Dispatch compute work items
-		vkCmdDispatch(device.computeCommandBuffer, numWorkgroups, 1, 1);
+		// Bind pipeline and descriptor sets
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+						  pipelineLayout, 0, 1, &descriptorSet, 0, 0);
 
-		//vkCmdPipelineBarrier(device.computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
-							//1, new VkMemoryBarrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT}, 0, {}, 0, {});
+		// Push constants hold for every dispatch recorded after them
+		if (!pushConstants.empty())
+			vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, pushConstants.size(), pushConstants.data());
+
+		VkMemoryBarrier dispatchBarrier {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_SHADER_WRITE_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_READ_BIT};
+		VkMemoryBarrier outputBarrier {VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_READ_BIT};
+
+		for (uint32_t i = 0; i < iterations; i++) {
+			// Reset per-iteration state on the GPU instead of round-tripping through the host
+			for (auto &buf : resetBuffers)
+				buf.recordFill(commandBuffer, 0);
+
+			// Dispatch compute work items, bracketed by timestamps once all earlier work has drained
+			if (queryPool != VK_NULL_HANDLE)
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * i);
+			vkCmdDispatch(commandBuffer, numWorkgroups, 1, 1);
+			if (queryPool != VK_NULL_HANDLE)
+				vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, 2 * i + 1);
+
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+								 VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &dispatchBarrier, 0, {}, 0, {});
+
+			// Save this iteration's outputs into their slots before the next reset overwrites them
+			if (!outputBuffers.empty()) {
+				for (auto &out : outputBuffers) {
+					VkDeviceSize slotBytes = out.first.count() * sizeof(uint32_t);
+					VkBufferCopy region {0, i * slotBytes, slotBytes};
+					vkCmdCopyBuffer(commandBuffer, out.first.buffer, out.second.buffer, 1, &region);
+				}
+				vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+									 VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &outputBarrier, 0, {}, 0, {});
+			}
+		}
 
 		// End recording command buffer
-		vkCheck(vkEndCommandBuffer(device.computeCommandBuffer));
+		vkCheck(vkEndCommandBuffer(commandBuffer));
 	}
 
-	void Program::run() {
+	easyvk::Submission Program::runAsync() {
 	    // Define submit info
 		VkSubmitInfo submitInfo {
 			VK_STRUCTURE_TYPE_SUBMIT_INFO,
@@ -541,45 +1128,178 @@ namespace easyvk {
 			nullptr,
 			nullptr,
 			1,
-			&device.computeCommandBuffer,
+			&commandBuffer,
 			0,
             nullptr
 		};
 
 		auto queue = device.computeQueue();
 
-		// Submit command buffer to queue, then wait until queue comes back to idle state
-		vkCheck(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
-		vkCheck(vkQueueWaitIdle(queue));
+		// Submit command buffer to queue, signalling this program's fence on completion
+		vkCheck(vkResetFences(device.device, 1, &fence));
+		easyvk::Submission submission(device, fence);
+		vkCheck(vkQueueSubmit(queue, 1, &submitInfo, fence));
+		return submission;
+	}
+
+	void Program::run() {
+		runAsync().wait();
+	}
+
+	std::vector<double> Program::kernelTimesNs() {
+		std::vector<double> times;
+		if (queryPool == VK_NULL_HANDLE)
+			return times;
+
+		std::vector<uint64_t> stamps(2 * iterations);
+		vkCheck(vkGetQueryPoolResults(device.device, queryPool, 0, 2 * iterations, stamps.size() * sizeof(uint64_t),
+									  stamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+
+		// Only the low timestampValidBits bits are meaningful, so take differences modulo that width
+		uint64_t mask = device.capabilities.timestampValidBits >= 64 ? ~0ULL : (1ULL << device.capabilities.timestampValidBits) - 1;
+		float period = device.properties.limits.timestampPeriod;
+		for (uint32_t i = 0; i < iterations; i++)
+			times.push_back(double((stamps[2 * i + 1] - stamps[2 * i]) & mask) * period);
+		return times;
+	}
+
+	Submission::Submission(easyvk::Device &_device, VkFence _fence) :
+		device(_device),
+		fence(_fence),
+		timing(std::make_shared<Timing>()) {
+		timing->submitted = std::chrono::steady_clock::now();
+	}
+
+	void Submission::markCompleted() {
+		if (!timing->done) {
+			timing->completed = std::chrono::steady_clock::now();
+			timing->done = true;
+		}
+	}
+
+	bool Submission::ready() {
+		VkResult res = vkGetFenceStatus(device.device, fence);
+		if (res == VK_NOT_READY)
+			return false;
+		vkCheck(res);
+		markCompleted();
+		return true;
+	}
+
+	bool Submission::wait(easyvk::WaitStrategy strategy, uint64_t timeoutNs) {
+		switch (strategy) {
+			case WaitStrategy::Poll: {
+				auto start = std::chrono::steady_clock::now();
+				while (!ready()) {
+					auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+					if (timeoutNs != UINT64_MAX && uint64_t(waited.count()) >= timeoutNs)
+						return false;
+					std::this_thread::yield();
+				}
+				return true;
+			}
+			case WaitStrategy::Timed: {
+				VkResult res = vkWaitForFences(device.device, 1, &fence, VK_TRUE, timeoutNs);
+				if (res == VK_TIMEOUT)
+					return false;
+				vkCheck(res);
+				markCompleted();
+				return true;
+			}
+			case WaitStrategy::Block:
+			default:
+				vkCheck(vkWaitForFences(device.device, 1, &fence, VK_TRUE, UINT64_MAX));
+				markCompleted();
+				return true;
+		}
+	}
+
+	std::future<bool> Submission::future(easyvk::WaitStrategy strategy, uint64_t timeoutNs) {
+		// The copy shares timing state, so latencyUs() on this handle sees the worker's result after get()
+		easyvk::Submission self = *this;
+		return std::async(std::launch::async, [self, strategy, timeoutNs]() mutable {
+			return self.wait(strategy, timeoutNs);
+		});
+	}
+
+	double Submission::latencyUs() {
+		if (!timing->done)
+			return -1;
+		return std::chrono::duration<double, std::micro>(timing->completed - timing->submitted).count();
 	}
 
 	void Program::setWorkgroups(uint32_t _numWorkgroups) {
 		numWorkgroups = _numWorkgroups;
 	}
 
+	void Program::setEntryPoint(const std::string &name) {
+		entryPoint = name;
+	}
+
 	void Program::setWorkgroupSize(uint32_t _workgroupSize) {
 		workgroupSize = _workgroupSize;
+		setSpecConstant(0, workgroupSize);
 	}
 
-	void Program::initialize() {
-		descriptorSetLayout = createDescriptorSetLayout(device, buffers.size());
+	void Program::setSpecConstantBytes(uint32_t id, const void* value, size_t size) {
+		for (auto &entry : specEntries) {
+			if (entry.constantID != id)
+				continue;
+			if (entry.size != size)
+				throw std::runtime_error("Specialization constant " + std::to_string(id) + " was set with a different type");
+			std::memcpy(specData.data() + entry.offset, value, size);
+			return;
+		}
+		specEntries.push_back(VkSpecializationMapEntry{id, (uint32_t)specData.size(), size});
+		specData.resize(specData.size() + size);
+		std::memcpy(specData.data() + specEntries.back().offset, value, size);
+	}
 
-		// Define pipeline layout info
+	void Program::createPipelineLayout() {
+		if (pushConstants.size() > device.properties.limits.maxPushConstantsSize)
+			throw std::runtime_error("Push constants of " + std::to_string(pushConstants.size()) + " bytes exceed the device limit of "
+				+ std::to_string(device.properties.limits.maxPushConstantsSize));
+		if (pushConstants.size() % 4 != 0)
+			throw std::runtime_error("Push constants must be a multiple of 4 bytes");
+		if (pipelineLayout != VK_NULL_HANDLE)
+			vkDestroyPipelineLayout(device.device, pipelineLayout, nullptr);
+
+		// Define pipeline layout info, with a push-constant range only if there are push constants
+		VkPushConstantRange pushConstantRange {VK_SHADER_STAGE_COMPUTE_BIT, 0, (uint32_t)pushConstants.size()};
 		VkPipelineLayoutCreateInfo createInfo {
 			VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
 			nullptr,
 			VkPipelineLayoutCreateFlags {},
 			1,
 			&descriptorSetLayout,
-			1,
-			new VkPushConstantRange {VK_SHADER_STAGE_COMPUTE_BIT, 0, easyvk::push_constant_size_bytes}
+			pushConstants.empty() ? 0u : 1u,
+			pushConstants.empty() ? nullptr : &pushConstantRange
 		};
 
+		// Create a new pipeline layout object
+		vkCheck(vkCreatePipelineLayout(device.device, &createInfo, nullptr, &pipelineLayout));
+		layoutPushConstantBytes = pushConstants.size();
+	}
+
+	void Program::setIterations(uint32_t _iterations) {
+		iterations = _iterations;
+	}
+
+	void Program::addResetBuffer(easyvk::Buffer &buffer) {
+		resetBuffers.push_back(buffer);
+	}
+
+	void Program::addOutputBuffer(easyvk::Buffer &source, easyvk::Buffer &slots) {
+		outputBuffers.push_back(std::make_pair(source, slots));
+	}
+
+	void Program::initialize() {
+		descriptorSetLayout = createDescriptorSetLayout(device, buffers.size());
+
 		// Print out device's properties information
 		if(!printDeviceInfo) printDeviceInfo = true;
 
-		// Create a new pipeline layout object
-		vkCheck(vkCreatePipelineLayout(device.device, &createInfo, nullptr, &pipelineLayout));
+		// The pipeline layout waits for prepare(), once the push constants' size is known
 
 		// Define descriptor pool size
 		VkDescriptorPoolSize poolSize {
@@ -607,6 +1327,12 @@ namespace easyvk {
 
 		writeSets(descriptorSet, buffers, writeDescriptorSets, bufferInfos);
 
+		commandBuffer = device.acquireCommandBuffer();
+
+		// Create the fence signalled by runAsync() submissions
+		VkFenceCreateInfo fenceCreateInfo {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, nullptr, VkFenceCreateFlags {}};
+		vkCheck(vkCreateFence(device.device, &fenceCreateInfo, nullptr, &fence));
+
 		// Update contents of descriptor set object
 		vkUpdateDescriptorSets(device.device, writeDescriptorSets.size(), &writeDescriptorSets.front(), 0,{});
 	}
@@ -629,7 +1355,13 @@ namespace easyvk {
 		vkDestroyShaderModule(device.device, shaderModule, nullptr);
 		vkDestroyDescriptorPool(device.device, descriptorPool, nullptr);
 		vkDestroyDescriptorSetLayout(device.device, descriptorSetLayout, nullptr);
-		vkDestroyPipelineLayout(device.device, pipelineLayout, nullptr);
-		vkDestroyPipeline(device.device, pipeline, nullptr);
+		if (pipelineLayout != VK_NULL_HANDLE)
+			vkDestroyPipelineLayout(device.device, pipelineLayout, nullptr);
+		if (pipeline != VK_NULL_HANDLE)
+			vkDestroyPipeline(device.device, pipeline, nullptr);
+		vkDestroyFence(device.device, fence, nullptr);
+		device.releaseCommandBuffer(commandBuffer);
+		if (queryPool != VK_NULL_HANDLE)
+			vkDestroyQueryPool(device.device, queryPool, nullptr);
 	}
 }
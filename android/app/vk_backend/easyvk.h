@@ -1,63 +1,249 @@
 #include <vulkan/vulkan.h>
 #include <vector>
+#include <utility>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <functional>
+#include <type_traits>
 
 namespace easyvk {
 
-	const uint32_t push_constant_size_bytes = 20;
-
 	class Device;
 	class Buffer;
 
+	// Directory for on-disk pipeline caches, read when a Device is created and written on teardown.
+	// Empty (the default) disables persistence.
+	void setPipelineCacheDir(const std::string &dir);
+
+	// Where a Buffer's memory lives
+	enum class MemoryPolicy {
+		Auto,			// device-local if it is also host-visible, device-local on discrete GPUs, host-visible otherwise
+		DeviceLocal,	// device-local; if not host-visible, host access goes through a staging buffer
+		HostCoherent,	// host-visible and coherent
+		HostCached		// host-visible and cached, preferred for readback; flushed and invalidated explicitly when non-coherent
+	};
+
+	// How a caller waits on a Submission's fence
+	enum class WaitStrategy {
+		Block,	// vkWaitForFences with no timeout
+		Poll,	// spin on vkGetFenceStatus, yielding between checks
+		Timed	// vkWaitForFences bounded by a timeout, caller retries
+	};
+
+	// A physical device's properties, gathered without creating a logical device
+	struct PhysicalDeviceInfo {
+		uint32_t index;
+		VkPhysicalDevice physicalDevice;
+		VkPhysicalDeviceProperties properties;
+	};
+
+	// Optional features and limits of a physical device, probed before a logical device is created.
+	// A Device enables every optional feature reported here as supported.
+	struct Capabilities {
+		uint32_t apiVersion = 0;
+		// VK_KHR_vulkan_memory_model
+		bool vulkanMemoryModel = false;
+		bool vulkanMemoryModelDeviceScope = false;
+		// Invocations per subgroup, and the operations compute shaders may use on them
+		uint32_t subgroupSize = 0;
+		bool subgroupCompute = false;
+		VkSubgroupFeatureFlags subgroupOperations = 0;
+		// VK_KHR_shader_clock
+		bool shaderSubgroupClock = false;
+		bool shaderDeviceClock = false;
+		// VK_KHR_shader_atomic_int64, for storage buffers
+		bool shaderBufferInt64Atomics = false;
+		// VK_KHR_timeline_semaphore
+		bool timelineSemaphore = false;
+		// VK_KHR_buffer_device_address
+		bool bufferDeviceAddress = false;
+		// Valid bits of timestamps written on the compute queue; 0 if timestamps are unsupported
+		uint32_t timestampValidBits = 0;
+		// Nanoseconds per timestamp tick
+		float timestampPeriod = 0;
+	};
+
+	class Instance;
+
+	// computeFamilyId is the queue family whose timestamp support is reported. Devices without
+	// vkGetPhysicalDeviceFeatures2, core or through VK_KHR_get_physical_device_properties2, report no optional
+	// features and an unknown (0) subgroup size.
+	Capabilities probeCapabilities(Instance &instance, VkPhysicalDevice physicalDevice, uint32_t computeFamilyId);
+
 	class Instance {
 		public:
 			Instance(bool = false);
-			std::vector<easyvk::Device> devices();
+			std::vector<easyvk::PhysicalDeviceInfo> physicalDevices();
+			// Each selector creates a logical device for the first matching GPU only,
+			// and throws std::runtime_error if none matches
+			easyvk::Device selectDevice(uint32_t index);
+			easyvk::Device selectDevice(const std::string &nameSubstring);
+			easyvk::Device selectDevice(VkPhysicalDeviceType type);
+			// Instance-level entry point, or nullptr if the loader doesn't provide it
+			PFN_vkVoidFunction procAddr(const char* name);
 			void teardown();
+			// Vulkan 1.1 if the loader supports it, otherwise 1.0
+			uint32_t apiVersion = VK_API_VERSION_1_0;
+			// VK_KHR_get_physical_device_properties2 is enabled, for probing devices below 1.1
+			bool properties2Extension = false;
 		private:
 			bool enableValidationLayers;
 			VkInstance instance;
 			VkDebugReportCallbackEXT debugReportCallback;
 	};
 
+	// A slice of one of an Arena's device memory blocks
+	struct Allocation {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		uint32_t block = 0;
+		// Host address of the slice if its block is host-visible, otherwise nullptr
+		void* mapped = nullptr;
+	};
+
+	// Sub-allocator that makes a few large vkAllocateMemory calls per memory type and hands out
+	// aligned slices of them, so creating many small buffers doesn't hit the driver's allocator
+	class Arena {
+		public:
+			Arena() = default;
+			Arena(VkDevice _device, VkPhysicalDevice physicalDevice, VkDeviceSize _minAlignment, VkDeviceSize _nonCoherentAtomSize);
+			Allocation allocate(VkMemoryRequirements requirements, uint32_t memoryType);
+			void free(const Allocation &allocation);
+			// Number of live vkAllocateMemory allocations backing the arena
+			uint32_t blockCount();
+			void teardown();
+		private:
+			struct Block {
+				VkDeviceMemory memory;
+				uint32_t memoryType;
+				VkDeviceSize size;
+				void* mapped;
+				// Free [offset, offset + size) ranges, sorted by offset
+				std::vector<std::pair<VkDeviceSize, VkDeviceSize>> freeRanges;
+			};
+			VkDevice device = VK_NULL_HANDLE;
+			VkPhysicalDeviceMemoryProperties memProperties;
+			VkDeviceSize minAlignment = 1;
+			VkDeviceSize nonCoherentAtomSize = 1;
+			std::vector<Block> blocks;
+			bool allocateFrom(Block &block, uint32_t index, VkDeviceSize size, VkDeviceSize alignment, Allocation &allocation);
+	};
+
 	class Device {
 		public:
 			Device(Instance &_instance, VkPhysicalDevice _physicalDevice);
 			VkDevice device;
 			VkPhysicalDeviceProperties properties;
 			uint32_t selectMemory(VkBuffer buffer, VkMemoryPropertyFlags flags);
+			uint32_t selectMemory(VkBuffer buffer, easyvk::MemoryPolicy policy);
+			VkMemoryPropertyFlags memoryTypeFlags(uint32_t memoryType);
 			VkQueue computeQueue();
-			VkCommandBuffer computeCommandBuffer;
+			// Command buffers are owned by Programs and recycled through the device's pool
+			VkCommandBuffer acquireCommandBuffer();
+			void releaseCommandBuffer(VkCommandBuffer commandBuffer);
+			// Records commands into a one-time command buffer, submits it and waits for completion
+			void runCommands(const std::function<void(VkCommandBuffer)> &record);
+			// What the device supports; every optional feature listed as supported is enabled
+			easyvk::Capabilities capabilities;
+			VkPipelineCache pipelineCache;
+			easyvk::Arena arena;
+			// True if a valid cache for this exact device and driver was loaded from disk
+			bool pipelineCacheHit = false;
+			// Set when a pipeline is created through the cache, cleared once the cache is saved
+			bool pipelineCacheChanged = false;
+			// Saves the cache if pipelines were created since the last save. teardown() always saves, but a
+			// process that is killed never gets there, so callers save after building pipelines too.
+			void syncPipelineCache();
 			void teardown();
 		private:
+			std::string pipelineCachePath();
+			void loadPipelineCache();
+			void savePipelineCache();
 			Instance &instance;
 			VkPhysicalDevice physicalDevice;
 			VkCommandPool computePool;
+			std::vector<VkCommandBuffer> freeCommandBuffers;
 			uint32_t computeFamilyId = uint32_t(-1);
 	};
 
 	class Buffer {
 		public:
-			Buffer(Device &device, uint32_t size);
+			Buffer(Device &device, uint32_t size, easyvk::MemoryPolicy policy = easyvk::MemoryPolicy::Auto);
 			VkBuffer buffer;
 
+			// load() and store() act on the host copy; call flush() after storing and invalidate() before loading
 			void store(size_t i, uint32_t value) {
+				if (data == nullptr)
+					createStaging();
 				*(data + i) = value;
 			}
 
 			uint32_t load(size_t i) {
+				if (data == nullptr)
+					createStaging();
 				return *(data + i);
 			}
-			void clear() {
-				for (uint32_t i = 0; i < size; i++)
-					store(i, 0);
+			// Zeroes the buffer, on the host if it is mapped and on the GPU otherwise
+			void clear();
+			// Records a vkCmdFillBuffer of the whole buffer, followed by a barrier that makes the fill
+			// visible to later compute and transfer commands
+			void recordFill(VkCommandBuffer commandBuffer, uint32_t value = 0);
+			// Makes host writes visible to the device: uploads from staging or flushes non-coherent memory
+			void flush();
+			// Makes device writes visible to the host: downloads into staging or invalidates non-coherent memory
+			void invalidate();
+
+			uint32_t count() {
+				return size;
+			}
+
+			VkMemoryPropertyFlags memoryFlags() {
+				return flags;
+			}
+
+			// True if host access goes through a separate staging buffer, which is only created once the host
+			// touches the buffer
+			bool staged() {
+				return !(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 			}
 
 			void teardown();
 		private:
 			easyvk::Device &device;
-			VkDeviceMemory memory;
+			easyvk::Allocation allocation;
+			VkMemoryPropertyFlags flags;
+			std::shared_ptr<easyvk::Buffer> staging;
 			uint32_t size;
-            uint32_t* data;
+            // Mapped memory, or staging's; null for a staged buffer until the host first accesses it
+            uint32_t* data = nullptr;
+			void createStaging();
+			void recordCopy(VkCommandBuffer commandBuffer, easyvk::Buffer &src, easyvk::Buffer &dst, VkPipelineStageFlags dstStage, VkAccessFlags dstAccess);
+	};
+
+	// Handle to an in-flight Program submission, signalled through the Program's fence
+	class Submission {
+		public:
+			Submission(Device &_device, VkFence _fence);
+			// Non-blocking check of the fence
+			bool ready();
+			// Returns false only if a Poll or Timed wait ran out of time
+			bool wait(WaitStrategy strategy = WaitStrategy::Block, uint64_t timeoutNs = UINT64_MAX);
+			std::future<bool> future(WaitStrategy strategy = WaitStrategy::Block, uint64_t timeoutNs = UINT64_MAX);
+			// Microseconds from submit until a wait observed completion, or -1 if not yet observed
+			double latencyUs();
+		private:
+			struct Timing {
+				std::chrono::steady_clock::time_point submitted;
+				std::chrono::steady_clock::time_point completed;
+				bool done = false;
+			};
+			easyvk::Device &device;
+			VkFence fence;
+			std::shared_ptr<Timing> timing;
+			void markCompleted();
 	};
 
 	class Program {
@@ -65,10 +251,46 @@ namespace easyvk {
 			Program(Device &_device, const char* filepath, std::vector<easyvk::Buffer> &buffers);
 			Program(Device &_device, std::vector<uint32_t> spvCode, std::vector<easyvk::Buffer> &buffers);
 			void initialize();
+			// Records into this program's own command buffer, which stays valid for repeated run() calls.
+			// The pipeline is rebuilt only if a specialization constant changed since the last prepare().
 			void prepare();
 			void run();
+			// Submits the prepared command buffer without waiting; at most one submission per Program may be in flight
+			easyvk::Submission runAsync();
+			// GPU time of each dispatch from the last completed run, in nanoseconds; empty if timestamps are unsupported
+			std::vector<double> kernelTimesNs();
 			void setWorkgroups(uint32_t _numWorkgroups);
+			// Kernel the pipeline runs; takes effect when prepare() next builds the pipeline, so set it before the first
+			void setEntryPoint(const std::string &name);
+			// Specialization constant 0, the X dimension clspv gives the kernel's workgroup size
 			void setWorkgroupSize(uint32_t _workgroupSize);
+			// Sets specialization constant `id` of the shader to `value` from the next prepare() on; the type
+			// must match the constant's declaration in the SPIR-V
+			template <typename T>
+			void setSpecConstant(uint32_t id, T value) {
+				static_assert(std::is_arithmetic<T>::value, "specialization constants are scalars");
+				setSpecConstantBytes(id, &value, sizeof(T));
+			}
+			// Boolean constants are 32 bits wide in SPIR-V
+			void setSpecConstant(uint32_t id, bool value) {
+				VkBool32 word = value ? VK_TRUE : VK_FALSE;
+				setSpecConstantBytes(id, &word, sizeof(word));
+			}
+			// Pushed before every dispatch recorded by the next prepare(), which only re-records the command buffer
+			// unless the size changed. T must match the layout of the shader's push-constant block, and the
+			// pipeline layout's push-constant range is sized to it.
+			template <typename T>
+			void setPushConstants(const T &value) {
+				static_assert(std::is_trivially_copyable<T>::value, "push constants are copied bytewise");
+				const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+				pushConstants.assign(bytes, bytes + sizeof(T));
+			}
+			// Batched mode: prepare() records this many dispatches into one command buffer
+			void setIterations(uint32_t _iterations);
+			// Zeroed on the GPU before every dispatch
+			void addResetBuffer(easyvk::Buffer &buffer);
+			// Copied into its own slot of `slots` after every dispatch (iteration i lands at i * source.count())
+			void addOutputBuffer(easyvk::Buffer &source, easyvk::Buffer &slots);
 			void teardown();
 		private:
 			std::vector<easyvk::Buffer> &buffers;
@@ -79,10 +301,27 @@ namespace easyvk {
 			VkDescriptorSet descriptorSet;
 			std::vector<VkWriteDescriptorSet> writeDescriptorSets;
 			std::vector<VkDescriptorBufferInfo> bufferInfos;
-			VkPipelineLayout pipelineLayout;
-			VkPipeline pipeline;
+			VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+			// Size of the push-constant range the pipeline layout was created with
+			size_t layoutPushConstantBytes = 0;
+			std::vector<uint8_t> pushConstants;
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			std::string entryPoint = "lock_test";
+			// Specialization constants for the next pipeline, and the ones the current pipeline was built with
+			std::vector<VkSpecializationMapEntry> specEntries;
+			std::vector<uint8_t> specData;
+			std::vector<uint8_t> pipelineSpecData;
+			VkCommandBuffer commandBuffer;
+			VkFence fence;
+			VkQueryPool queryPool = VK_NULL_HANDLE;
+			uint32_t queryPoolIterations = 0;
 			uint32_t numWorkgroups;
 			uint32_t workgroupSize;
+			uint32_t iterations = 1;
+			std::vector<easyvk::Buffer> resetBuffers;
+			std::vector<std::pair<easyvk::Buffer, easyvk::Buffer>> outputBuffers;
+			void setSpecConstantBytes(uint32_t id, const void* value, size_t size);
+			void createPipelineLayout();
 	};
 
 	const char* vkDeviceType(VkPhysicalDeviceType type);
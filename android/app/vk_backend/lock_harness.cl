@@ -0,0 +1,152 @@
+// Test kernel shared by every lock. A lock file includes this file and then defines lock() and unlock()
+// with the prototypes below. lock() returns how many times it retried: failed or repeated atomics on the
+// lock while waiting. `me` numbers the contending invocations from 0. `node` is private to the
+// lock and carried from one acquisition to the next; node->x starts at me + 1.
+//
+// iters is the number of acquisitions per contender and contention the contention width; clspv's
+// -pod-pushconstant passes both as push constants. res[0] counts acquisitions in the critical section, and
+// res[1] is set to the number of contenders the dispatch actually had: in subgroup contention it depends on
+// the subgroup size the device chose, which the host can't know in advance on devices with variable sizes.
+// Every contender acquires the lock the same number of times, so fairness is measured over the first half of
+// the test's acquisitions: acquisitions[g] counts those that went to workgroup g.
+//
+// retries[3 * g] and retries[3 * g + 1] are the low and high words of the sum of workgroup g's retries,
+// and retries[3 * g + 2] is the most any one of its acquisitions needed.
+//
+// LOCK_CLOCK, when set, times every call to lock() with the device or subgroup shader clock and counts it in
+// histogram[b], where b is the bit length of the elapsed ticks: 33 buckets, 0 for none and b for [2^(b-1), 2^b).
+//
+// With contention CONTENTION_DISCOVER the kernel tests no lock: it runs the occupancy poll of occupancy_poll.cl
+// on retries[0..3] instead. The pipeline still has the registers and memory of the lock path, so the count is
+// what this lock's dispatches can keep resident, which may be fewer than the discovery kernel alone finds.
+//
+// LOCK_ORDER picks the ordering of the atomics that acquire and release the lock, through LOCK_ACQUIRE
+// and LOCK_RELEASE. The relaxed default lets the critical section race, which the failure
+// count measures; the other orders are compiled with clspv's -vulkan-memory-model.
+
+#pragma OPENCL EXTENSION cl_khr_subgroups : enable
+
+#include "occupancy_poll.cl"
+
+#define CONTENTION_ONE 0       // invocation 0 of each workgroup
+#define CONTENTION_SUBGROUP 1  // invocation 0 of each subgroup
+#define CONTENTION_ALL 2       // every invocation
+#define CONTENTION_DISCOVER 3  // occupancy discovery instead of a test
+
+#define ORDER_RELAXED 0
+#define ORDER_ACQ_REL 1
+#define ORDER_SEQ_CST 2
+
+// Words between the garbage slots of neighbouring invocations; the host sizes the garbage buffer to match
+#define GARBAGE_STRIDE 4
+
+#define CLOCK_NONE 0
+#define CLOCK_DEVICE 1
+#define CLOCK_SUBGROUP 2
+
+#ifndef LOCK_CLOCK
+#define LOCK_CLOCK CLOCK_NONE
+#endif
+
+// Only the low word is read; a single acquisition never spans 2^32 ticks
+#if LOCK_CLOCK == CLOCK_DEVICE
+#pragma OPENCL EXTENSION cl_khr_kernel_clock : enable
+#define READ_CLOCK() clock_read_hilo_device().x
+#elif LOCK_CLOCK == CLOCK_SUBGROUP
+#pragma OPENCL EXTENSION cl_khr_kernel_clock : enable
+#define READ_CLOCK() clock_read_hilo_sub_group().x
+#endif
+
+#ifndef LOCK_ORDER
+#define LOCK_ORDER ORDER_RELAXED
+#endif
+
+#if LOCK_ORDER == ORDER_SEQ_CST
+#define LOCK_ACQUIRE memory_order_seq_cst
+#define LOCK_RELEASE memory_order_seq_cst
+#elif LOCK_ORDER == ORDER_ACQ_REL
+#define LOCK_ACQUIRE memory_order_acquire
+#define LOCK_RELEASE memory_order_release
+#else
+#define LOCK_ACQUIRE memory_order_relaxed
+#define LOCK_RELEASE memory_order_relaxed
+#endif
+
+static uint lock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node);
+static void unlock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node);
+
+kernel void lock_test(global atomic_uint* l, global uint* res, global uint* garbage, global atomic_uint* acquisitions, global atomic_uint* histogram, global atomic_uint* retries, global atomic_uint* state, global uint* params, uint iters, uint contention) {
+    // Push constants are uniform across the dispatch, so every invocation takes the same path
+    if (contention == CONTENTION_DISCOVER) {
+        if (get_local_id(0) == 0)
+            occupancy_poll(retries);
+        return;
+    }
+    bool contends;
+    uint me;
+    uint contenders;
+    if (contention == CONTENTION_ALL) {
+        contends = true;
+        me = get_global_id(0);
+        contenders = get_global_size(0);
+    } else if (contention == CONTENTION_SUBGROUP) {
+        contends = get_sub_group_local_id() == 0;
+        me = get_group_id(0) * get_num_sub_groups() + get_sub_group_id();
+        contenders = get_num_groups(0) * get_num_sub_groups();
+    } else {
+        contends = get_local_id(0) == 0;
+        me = get_group_id(0);
+        contenders = get_num_groups(0);
+    }
+    // Half of contenders * iters, without overflowing where the product itself would fit
+    uint window = contenders / 2 * iters + (contenders % 2) * (iters / 2);
+    if (contends && me == 0)
+        res[1] = contenders;
+
+    if (!contends) {
+        uint i = get_local_id(0) * GARBAGE_STRIDE;
+        for (uint j = 0; j < iters; j++) {
+            uint x = garbage[i];
+            x += get_local_id(0);
+            garbage[i] = x;
+        }
+    } else {
+        uint2 node = (uint2)(me + 1, 0);
+        uint in_window = 0;
+        uint retry_sum = 0;
+        uint retry_sum_high = 0;
+        uint retry_max = 0;
+        for (uint i = 0; i < iters; i++) {
+#if LOCK_CLOCK != CLOCK_NONE
+            uint start = READ_CLOCK();
+            uint retried = lock(l, state, params, me, &node);
+            uint ticks = READ_CLOCK() - start;
+#else
+            uint retried = lock(l, state, params, me, &node);
+#endif
+
+            uint x = *res;
+            if (x < window)
+                in_window++;
+            x++;
+            *res = x;
+
+            unlock(l, state, params, me, &node);
+#if LOCK_CLOCK != CLOCK_NONE
+            // Recorded after unlock() so the histogram atomics stay out of the critical section
+            atomic_fetch_add_explicit(&histogram[32 - clz(ticks)], 1, memory_order_relaxed);
+#endif
+            retry_sum += retried;
+            if (retry_sum < retried)
+                retry_sum_high++;
+            retry_max = max(retry_max, retried);
+        }
+        atomic_fetch_add_explicit(&acquisitions[get_group_id(0)], in_window, memory_order_relaxed);
+        global atomic_uint* workgroup_retries = &retries[3 * get_group_id(0)];
+        uint old = atomic_fetch_add_explicit(&workgroup_retries[0], retry_sum, memory_order_relaxed);
+        if (old + retry_sum < old)
+            retry_sum_high++;
+        atomic_fetch_add_explicit(&workgroup_retries[1], retry_sum_high, memory_order_relaxed);
+        atomic_fetch_max_explicit(&workgroup_retries[2], retry_max, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,197 @@
+#include "lock_registry.h"
+
+using std::vector;
+using std::string;
+
+vector<uint32_t> tas_spv(LockOrder order, LockClock clock) {
+    if (clock == LockClock::Device) return
+        #include "tas_lock_clock_device.cinit"
+        ;
+    if (clock == LockClock::Subgroup) return
+        #include "tas_lock_clock_subgroup.cinit"
+        ;
+    switch (order) {
+        case LockOrder::AcqRel: return
+            #include "tas_lock_acq_rel.cinit"
+            ;
+        case LockOrder::SeqCst: return
+            #include "tas_lock_seq_cst.cinit"
+            ;
+        default: return
+            #include "tas_lock.cinit"
+            ;
+    }
+}
+
+vector<uint32_t> ttas_spv(LockOrder order, LockClock clock) {
+    if (clock == LockClock::Device) return
+        #include "ttas_lock_clock_device.cinit"
+        ;
+    if (clock == LockClock::Subgroup) return
+        #include "ttas_lock_clock_subgroup.cinit"
+        ;
+    switch (order) {
+        case LockOrder::AcqRel: return
+            #include "ttas_lock_acq_rel.cinit"
+            ;
+        case LockOrder::SeqCst: return
+            #include "ttas_lock_seq_cst.cinit"
+            ;
+        default: return
+            #include "ttas_lock.cinit"
+            ;
+    }
+}
+
+vector<uint32_t> cas_spv(LockOrder order, LockClock clock) {
+    if (clock == LockClock::Device) return
+        #include "cas_lock_clock_device.cinit"
+        ;
+    if (clock == LockClock::Subgroup) return
+        #include "cas_lock_clock_subgroup.cinit"
+        ;
+    switch (order) {
+        case LockOrder::AcqRel: return
+            #include "cas_lock_acq_rel.cinit"
+            ;
+        case LockOrder::SeqCst: return
+            #include "cas_lock_seq_cst.cinit"
+            ;
+        default: return
+            #include "cas_lock.cinit"
+            ;
+    }
+}
+
+vector<uint32_t> ticket_spv(LockOrder order, LockClock clock) {
+    if (clock == LockClock::Device) return
+        #include "ticket_lock_clock_device.cinit"
+        ;
+    if (clock == LockClock::Subgroup) return
+        #include "ticket_lock_clock_subgroup.cinit"
+        ;
+    switch (order) {
+        case LockOrder::AcqRel: return
+            #include "ticket_lock_acq_rel.cinit"
+            ;
+        case LockOrder::SeqCst: return
+            #include "ticket_lock_seq_cst.cinit"
+            ;
+        default: return
+            #include "ticket_lock.cinit"
+            ;
+    }
+}
+
+vector<uint32_t> backoff_ttas_spv(LockOrder order, LockClock clock) {
+    if (clock == LockClock::Device) return
+        #include "backoff_ttas_lock_clock_device.cinit"
+        ;
+    if (clock == LockClock::Subgroup) return
+        #include "backoff_ttas_lock_clock_subgroup.cinit"
+        ;
+    switch (order) {
+        case LockOrder::AcqRel: return
+            #include "backoff_ttas_lock_acq_rel.cinit"
+            ;
+        case LockOrder::SeqCst: return
+            #include "backoff_ttas_lock_seq_cst.cinit"
+            ;
+        default: return
+            #include "backoff_ttas_lock.cinit"
+            ;
+    }
+}
+
+vector<uint32_t> mcs_spv(LockOrder order, LockClock clock) {
+    if (clock == LockClock::Device) return
+        #include "mcs_lock_clock_device.cinit"
+        ;
+    if (clock == LockClock::Subgroup) return
+        #include "mcs_lock_clock_subgroup.cinit"
+        ;
+    switch (order) {
+        case LockOrder::AcqRel: return
+            #include "mcs_lock_acq_rel.cinit"
+            ;
+        case LockOrder::SeqCst: return
+            #include "mcs_lock_seq_cst.cinit"
+            ;
+        default: return
+            #include "mcs_lock.cinit"
+            ;
+    }
+}
+
+vector<uint32_t> clh_spv(LockOrder order, LockClock clock) {
+    if (clock == LockClock::Device) return
+        #include "clh_lock_clock_device.cinit"
+        ;
+    if (clock == LockClock::Subgroup) return
+        #include "clh_lock_clock_subgroup.cinit"
+        ;
+    switch (order) {
+        case LockOrder::AcqRel: return
+            #include "clh_lock_acq_rel.cinit"
+            ;
+        case LockOrder::SeqCst: return
+            #include "clh_lock_seq_cst.cinit"
+            ;
+        default: return
+            #include "clh_lock.cinit"
+            ;
+    }
+}
+
+const char* lock_order_name(LockOrder order) {
+    switch (order) {
+        case LockOrder::AcqRel: return "acq-rel";
+        case LockOrder::SeqCst: return "seq-cst";
+        default: return "relaxed";
+    }
+}
+
+// Each lock is registered in every order, plus a relaxed variant that measures acquire latency.
+// The relaxed variant keeps the plain name.
+static vector<LockSpec> with_variants(const vector<LockSpec>& locks) {
+    vector<LockSpec> variants;
+    for (auto& lock : locks) {
+        for (LockOrder order : { LockOrder::Relaxed, LockOrder::AcqRel, LockOrder::SeqCst }) {
+            LockSpec variant = lock;
+            variant.order = order;
+            if (order != LockOrder::Relaxed) {
+                variant.name += string("-") + lock_order_name(order);
+                variant.label += string(" (") + lock_order_name(order) + ")";
+            }
+            variants.push_back(variant);
+        }
+        LockSpec latency = lock;
+        latency.name += "-latency";
+        latency.label += " (latency)";
+        latency.latency = true;
+        variants.push_back(latency);
+    }
+    return variants;
+}
+
+// Locks run and reported in this order
+const vector<LockSpec>& lock_registry() {
+    static const vector<LockSpec> registry = with_variants({
+        {"tas", "TAS", "tas", LockOrder::Relaxed, tas_spv, {}, 0, 0, false},
+        {"ttas", "TTAS", "ttas", LockOrder::Relaxed, ttas_spv, {}, 0, 0, false},
+        {"cas", "CAS", "cas", LockOrder::Relaxed, cas_spv, {}, 0, 0, false},
+        {"ticket", "Ticket", "ticket", LockOrder::Relaxed, ticket_spv, {}, 1, 0, false},
+        {"backoff-ttas", "TTAS with backoff", "backoff-ttas", LockOrder::Relaxed, backoff_ttas_spv, {{"backoff-min", 16}, {"backoff-max", 4096}}, 0, 0, false},
+        {"mcs", "MCS", "mcs", LockOrder::Relaxed, mcs_spv, {}, 0, 2, false},
+        {"clh", "CLH", "clh", LockOrder::Relaxed, clh_spv, {}, 1, 1, false}
+    });
+    return registry;
+}
+
+const LockSpec* find_lock(const string& name) {
+    for (auto& spec : lock_registry()) {
+        if (spec.name == name)
+            return &spec;
+    }
+    return nullptr;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A tunable value a lock kernel reads from its params buffer, in declaration order
+struct LockParam {
+    std::string name;
+    uint32_t default_value;
+};
+
+// Ordering of the atomics that acquire and release a lock; values match LOCK_ORDER in lock_harness.cl
+enum class LockOrder {
+    Relaxed = 0,
+    AcqRel = 1,
+    SeqCst = 2
+};
+
+const char* lock_order_name(LockOrder order);
+
+// Shader clock a latency variant reads around lock(); values match LOCK_CLOCK in lock_harness.cl
+enum class LockClock {
+    None = 0,
+    Device = 1,
+    Subgroup = 2
+};
+
+// Everything the test engine needs to build, run and report one lock.
+// Its kernel is a lock()/unlock() pair built on lock_harness.cl, which fixes the buffer layout.
+struct LockSpec {
+    // Short name; selects the lock and prefixes its keys in the JSON report
+    std::string name;
+    std::string label;
+    // Name shared by every memory-order variant of the same algorithm
+    std::string family;
+    LockOrder order;
+    // Any clock other than None selects the latency variant, compiled for that clock
+    std::vector<uint32_t> (*spv_code)(LockOrder order, LockClock clock);
+    std::vector<LockParam> params;
+    // Words of lock-private state, zeroed before every test iteration; 0 if the lock only uses the shared lock word
+    uint32_t state_words;
+    // Further state words for each contending invocation, such as queue nodes
+    uint32_t state_words_per_contender;
+    // Times each acquisition with the shader clock into a histogram; needs VK_KHR_shader_clock
+    bool latency;
+
+    // Variants with ordered atomics are compiled for the Vulkan memory model. Their atomics are device-scoped,
+    // so the device must support both vulkanMemoryModel and vulkanMemoryModelDeviceScope.
+    bool needs_vulkan_memory_model() const {
+        return order != LockOrder::Relaxed;
+    }
+};
+
+const std::vector<LockSpec>& lock_registry();
+
+// nullptr if no lock has this name
+const LockSpec* find_lock(const std::string& name);
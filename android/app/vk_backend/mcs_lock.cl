@@ -0,0 +1,30 @@
+#include "lock_harness.cl"
+
+// Each contender owns the node at state[2 * me]: the next waiter (contender + 1, 0 for none) and its
+// own locked flag, so a waiter spins only on its own node. l holds the tail of the queue as contender + 1.
+// Queue links always use acquire/release so a node is initialized before its predecessor can hand over;
+// LOCK_ORDER applies to the handoff itself.
+static uint lock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    uint retries = 0;
+    atomic_store_explicit(&state[2 * me], 0, memory_order_relaxed);
+    atomic_store_explicit(&state[2 * me + 1], 1, memory_order_relaxed);
+    uint pred = atomic_exchange_explicit(l, me + 1, memory_order_acq_rel);
+    if (pred != 0) {
+        atomic_store_explicit(&state[2 * (pred - 1)], me + 1, memory_order_release);
+        while (atomic_load_explicit(&state[2 * me + 1], LOCK_ACQUIRE))
+            retries++;
+    }
+    return retries;
+}
+
+static void unlock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    uint succ = atomic_load_explicit(&state[2 * me], memory_order_acquire);
+    if (succ == 0) {
+        uint e = me + 1;
+        if (atomic_compare_exchange_strong_explicit(l, &e, 0, memory_order_acq_rel, memory_order_relaxed))
+            return;
+        // A waiter swapped itself in but hasn't linked to this node yet
+        while ((succ = atomic_load_explicit(&state[2 * me], memory_order_acquire)) == 0);
+    }
+    atomic_store_explicit(&state[2 * (succ - 1) + 1], 0, LOCK_RELEASE);
+}
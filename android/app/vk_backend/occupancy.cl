@@ -0,0 +1,11 @@
+// Occupancy discovery: counts the workgroups of a dispatch that are guaranteed to be resident at the same
+// time, so lock tests never spin across workgroups that the GPU would only schedule once others finish.
+// The kernel does nothing else, so its count is an upper bound for the heavier lock kernels; the host
+// checks each lock's pipeline against it (see CONTENTION_DISCOVER in lock_harness.cl).
+
+#include "occupancy_poll.cl"
+
+kernel void occupancy(global atomic_uint* discovery) {
+    if (get_local_id(0) == 0)
+        occupancy_poll(discovery);
+}
@@ -0,0 +1,41 @@
+// Occupancy poll, run by invocation 0 of each workgroup of a dispatch; afterwards discovery[3] holds a count
+// of workgroups that were all resident at the same time. Shared by the occupancy discovery kernel and by
+// lock_harness.cl, which runs it on each lock's own pipeline.
+//
+// Each workgroup takes two turns of a ticket lock. In its first turn it registers if the poll is still open;
+// in its second it closes the poll, and whoever closes it first records how many had registered. A registered
+// workgroup cannot finish before the poll closes, and every registration precedes the first close in ticket
+// order, so all registered workgroups were running together.
+//
+// discovery[0] is the next ticket, discovery[1] the ticket being served, discovery[2] the poll (registrations
+// plus POLL_CLOSED once closed) and discovery[3] the count at closing. The buffer starts zeroed.
+//
+// The poll is only ever updated by read-modify-writes, which always see its latest value, so relaxed
+// atomics are enough; the ticket lock only has to order the turns, not protect data.
+
+#define POLL_CLOSED 0x80000000u
+
+static void take_turn(global atomic_uint* discovery) {
+    uint ticket = atomic_fetch_add_explicit(&discovery[0], 1, memory_order_relaxed);
+    while (atomic_load_explicit(&discovery[1], memory_order_relaxed) != ticket);
+}
+
+static void end_turn(global atomic_uint* discovery) {
+    atomic_fetch_add_explicit(&discovery[1], 1, memory_order_relaxed);
+}
+
+static void occupancy_poll(global atomic_uint* discovery) {
+    // Workgroups that start after the poll closed leave without queueing; a stale read only costs two turns
+    if (atomic_load_explicit(&discovery[2], memory_order_relaxed) & POLL_CLOSED)
+        return;
+
+    take_turn(discovery);
+    atomic_fetch_add_explicit(&discovery[2], 1, memory_order_relaxed);
+    end_turn(discovery);
+
+    take_turn(discovery);
+    uint poll = atomic_fetch_or_explicit(&discovery[2], POLL_CLOSED, memory_order_relaxed);
+    if (!(poll & POLL_CLOSED))
+        atomic_store_explicit(&discovery[3], poll, memory_order_relaxed);
+    end_turn(discovery);
+}
@@ -0,0 +1,84 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+using std::vector;
+
+double mean(const vector<double>& xs) {
+    if (xs.empty())
+        return 0;
+    return std::accumulate(xs.begin(), xs.end(), 0.0) / xs.size();
+}
+
+double stddev(const vector<double>& xs) {
+    if (xs.size() < 2)
+        return 0;
+    double m = mean(xs);
+    double sq = 0;
+    for (double x : xs)
+        sq += (x - m) * (x - m);
+    return sqrt(sq / (xs.size() - 1));
+}
+
+// Linear interpolation between closest ranks of sorted samples
+static double quantile(const vector<double>& sorted, double q) {
+    if (sorted.empty())
+        return 0;
+    double pos = q * (sorted.size() - 1);
+    size_t lo = (size_t)pos;
+    size_t hi = std::min(lo + 1, sorted.size() - 1);
+    return sorted[lo] + (pos - lo) * (sorted[hi] - sorted[lo]);
+}
+
+double median(vector<double> xs) {
+    std::sort(xs.begin(), xs.end());
+    return quantile(xs, 0.5);
+}
+
+// Two-sided 95% critical value of Student's t with `df` degrees of freedom
+static double t95(size_t df) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (df == 0)
+        return 0;
+    if (df <= 30)
+        return table[df - 1];
+    // Between rows, the row with fewer degrees of freedom, so the interval errs wide rather than narrow
+    if (df < 60)
+        return 2.042;
+    if (df < 120)
+        return 2.000;
+    return 1.980;
+}
+
+Summary summarize(const vector<double>& xs) {
+    Summary s;
+    s.n = xs.size();
+    if (xs.empty())
+        return s;
+    vector<double> sorted = xs;
+    std::sort(sorted.begin(), sorted.end());
+    s.mean = mean(xs);
+    s.stddev = stddev(xs);
+    s.median = quantile(sorted, 0.5);
+    s.min = sorted.front();
+    s.max = sorted.back();
+
+    double half_width = s.n > 1 ? t95(s.n - 1) * s.stddev / sqrt((double)s.n) : 0;
+    s.ci95_low = s.mean - half_width;
+    s.ci95_high = s.mean + half_width;
+
+    double q1 = quantile(sorted, 0.25);
+    double q3 = quantile(sorted, 0.75);
+    double fence = 1.5 * (q3 - q1);
+    for (size_t i = 0; i < xs.size(); i++) {
+        if (xs[i] < q1 - fence || xs[i] > q3 + fence)
+            s.outliers.push_back(i);
+    }
+    return s;
+}
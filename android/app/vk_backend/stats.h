@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+double mean(const std::vector<double>& xs);
+
+// Sample standard deviation; 0 for fewer than two samples
+double stddev(const std::vector<double>& xs);
+
+double median(std::vector<double> xs);
+
+// Summary of one metric sampled once per test iteration
+struct Summary {
+    size_t n = 0;
+    double mean = 0;
+    double stddev = 0;
+    double median = 0;
+    double min = 0;
+    double max = 0;
+    // 95% confidence interval of the mean, from Student's t; collapses to the mean for fewer than two samples
+    double ci95_low = 0;
+    double ci95_high = 0;
+    // Samples outside Tukey's fences (1.5 interquartile ranges beyond the quartiles), by iteration index
+    std::vector<size_t> outliers;
+};
+
+Summary summarize(const std::vector<double>& xs);
@@ -0,0 +1,14 @@
+#include "lock_harness.cl"
+
+// l hands out tickets; state[0] is the ticket now being served
+static uint lock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    uint retries = 0;
+    uint ticket = atomic_fetch_add_explicit(l, 1, memory_order_relaxed);
+    while (atomic_load_explicit(state, LOCK_ACQUIRE) != ticket)
+        retries++;
+    return retries;
+}
+
+static void unlock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    atomic_fetch_add_explicit(state, 1, LOCK_RELEASE);
+}
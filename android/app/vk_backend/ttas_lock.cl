@@ -1,32 +1,16 @@
-static void lock(global atomic_uint* l) {
+#include "lock_harness.cl"
+
+static uint lock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    uint retries = 0;
     while(1) {
-        while(atomic_load_explicit(l, memory_order_relaxed));
-        if (!atomic_exchange_explicit(l, 1, memory_order_relaxed))
-            return;
+        while(atomic_load_explicit(l, memory_order_relaxed))
+            retries++;
+        if (!atomic_exchange_explicit(l, 1, LOCK_ACQUIRE))
+            return retries;
+        retries++;
     }
 }
 
-static void unlock(global atomic_uint* l) {
-    atomic_store_explicit(l, 0, memory_order_relaxed);
-}
-
-kernel void lock_test(global atomic_uint* l, global uint* res, global uint* iters, global uint* garbage) {
-    if (get_local_id(0) != 0) {
-        for (uint j = 0; j < *iters; j++) {
-            uint i = get_local_id(0) * 4;
-            uint x = garbage[i];
-            x += get_local_id(0);
-            garbage[i] = x;
-        }
-    } else {
-        for (uint i = 0; i < *iters; i++) {
-            lock(l);
-
-            uint x = *res;
-            x++;
-            *res = x;
-
-            unlock(l);
-        }
-    }
+static void unlock(global atomic_uint* l, global atomic_uint* state, global uint* params, uint me, uint2* node) {
+    atomic_store_explicit(l, 0, LOCK_RELEASE);
 }
@@ -1,9 +1,16 @@
 #include <stdexcept>
 #include <stdarg.h>
 #include <string>
+#include <cmath>
+#include <numeric>
+#include <memory>
+#include <map>
+#include <algorithm>
 
 #include "easyvk.h"
 #include "json.h"
+#include "lock_registry.h"
+#include "stats.h"
 
 #ifdef __ANDROID__
 #include <android/log.h>
@@ -19,6 +26,9 @@ using easyvk::Instance;
 using easyvk::Device;
 using easyvk::Buffer;
 using easyvk::Program;
+using easyvk::MemoryPolicy;
+using easyvk::Submission;
+using easyvk::WaitStrategy;
 using easyvk::vkDeviceType;
 
 const char* os_name() {
@@ -56,102 +66,628 @@ void log(const char* fmt, ...) {
     #ifdef __ANDROID__
     __android_log_vprint(ANDROID_LOG_INFO, APPNAME, fmt, args);
     #else
-    vprintf(fmt, args);
+    vfprintf(stderr, fmt, args);
     #endif
     va_end(args);
 }
 
-extern "C" char* run(uint32_t workgroups, uint32_t workgroup_size, uint32_t lock_iters, uint32_t test_iters) {
-    log("Initializing test...\n");
+// Which invocations take the lock; values match the CONTENTION_* constants in lock_harness.cl
+enum class Contention : uint32_t {
+    One = 0,       // invocation 0 of each workgroup
+    Subgroup = 1,  // invocation 0 of each subgroup
+    All = 2        // every invocation
+};
 
-    Instance instance = Instance(false);
-    Device device = instance.devices().at(0);
+// Contention value that makes lock_test run occupancy discovery on its own pipeline instead of a test
+const uint32_t contention_discover = 3;
 
-    log("Using device '%s'\n", device.properties.deviceName);
+const char* contention_name(Contention contention) {
+    switch (contention) {
+        case Contention::Subgroup: return "subgroup";
+        case Contention::All: return "all";
+        default: return "one";
+    }
+}
 
-    uint32_t maxComputeWorkGroupInvocations = device.properties.limits.maxComputeWorkGroupInvocations;
-    log("MaxComputeWorkGroupInvocations: %d\n", maxComputeWorkGroupInvocations);
-    if (workgroups > maxComputeWorkGroupInvocations)
-        workgroups = maxComputeWorkGroupInvocations;
+const char* wait_strategy_name(WaitStrategy strategy) {
+    switch (strategy) {
+        case WaitStrategy::Poll: return "poll";
+        case WaitStrategy::Timed: return "timed";
+        default: return "block";
+    }
+}
 
-    uint32_t test_total = workgroups * lock_iters;
-    uint32_t total_locks = test_total * test_iters;
+string memory_flags_string(Buffer& buffer) {
+    VkMemoryPropertyFlags flags = buffer.memoryFlags();
+    string res;
+    if (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+        res += "device-local ";
+    if (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        res += "host-visible ";
+    if (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+        res += "host-coherent ";
+    if (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)
+        res += "host-cached ";
+    if (buffer.staged())
+        res += "staged ";
+    if (!res.empty())
+        res.pop_back();
+    return res;
+}
 
-    Buffer lockBuf = Buffer(device, 1);
-    Buffer resultBuf = Buffer(device, 1);
-    Buffer lockItersBuf = Buffer(device, 1);
-    Buffer garbageBuf = Buffer(device, workgroup_size * 4);
-    vector<Buffer> buffers = { lockBuf, resultBuf, lockItersBuf, garbageBuf };
-    lockItersBuf.store(0, lock_iters);
+// Why the device can't run variants that need the Vulkan memory model, or null if it can
+const char* memory_model_missing(const easyvk::Capabilities& capabilities) {
+    if (!capabilities.vulkanMemoryModel)
+        return "no Vulkan memory model";
+    if (!capabilities.vulkanMemoryModelDeviceScope)
+        return "Vulkan memory model without device scope";
+    return nullptr;
+}
 
-    // -------------- TAS LOCK --------------
+json capabilities_json(const easyvk::Capabilities& capabilities) {
+    return {
+        {"api-version", std::to_string(VK_VERSION_MAJOR(capabilities.apiVersion)) + "." +
+                        std::to_string(VK_VERSION_MINOR(capabilities.apiVersion)) + "." +
+                        std::to_string(VK_VERSION_PATCH(capabilities.apiVersion))},
+        {"vulkan-memory-model", capabilities.vulkanMemoryModel},
+        {"vulkan-memory-model-device-scope", capabilities.vulkanMemoryModelDeviceScope},
+        {"subgroup-size", capabilities.subgroupSize},
+        {"subgroup-compute", capabilities.subgroupCompute},
+        {"subgroup-operations", capabilities.subgroupOperations},
+        {"shader-subgroup-clock", capabilities.shaderSubgroupClock},
+        {"shader-device-clock", capabilities.shaderDeviceClock},
+        {"shader-buffer-int64-atomics", capabilities.shaderBufferInt64Atomics},
+        {"timeline-semaphore", capabilities.timelineSemaphore},
+        {"buffer-device-address", capabilities.bufferDeviceAddress},
+        {"timestamp-valid-bits", capabilities.timestampValidBits},
+        {"timestamp-period-ns", capabilities.timestampPeriod}
+    };
+}
 
-    log("----------------------------------------------------------\n");
-    log("Testing TAS lock...\n");
-    log("%d workgroups, %d threads per workgroup, %d locks per thread, tests run %d times.\n", workgroups, workgroup_size, lock_iters, test_iters);
-    vector<uint32_t> tasSpvCode =
-    #include "tas_lock.cinit"
+// Per-dispatch GPU time in milliseconds, empty if the device can't write compute timestamps
+vector<double> kernel_times_ms(Program& program) {
+    vector<double> times = program.kernelTimesNs();
+    for (double& t : times)
+        t /= 1e6;
+    return times;
+}
+
+double acquisitions_per_second(int64_t acquisitions_per_test, const vector<double>& times_ms) {
+    double total_ms = std::accumulate(times_ms.begin(), times_ms.end(), 0.0);
+    if (total_ms <= 0)
+        return 0;
+    return (double)acquisitions_per_test * times_ms.size() / (total_ms / 1000.0);
+}
+
+// How evenly one test iteration's acquisitions were spread over workgroups
+struct Fairness {
+    double min;
+    double max;
+    // Standard deviation over mean; 0 when every workgroup got the same share
+    double cv;
+    // Jain's fairness index, (sum x)^2 / (n * sum x^2): 1 is perfectly fair, 1/n is one workgroup taking everything
+    double jain;
+};
+
+Fairness compute_fairness(const vector<double>& per_workgroup) {
+    Fairness f = {0, 0, 0, 1};
+    if (per_workgroup.empty())
+        return f;
+    f.min = *std::min_element(per_workgroup.begin(), per_workgroup.end());
+    f.max = *std::max_element(per_workgroup.begin(), per_workgroup.end());
+    double m = mean(per_workgroup);
+    f.cv = m > 0 ? stddev(per_workgroup) / m : 0;
+    double sum = 0, sum_sq = 0;
+    for (double x : per_workgroup) {
+        sum += x;
+        sum_sq += x * x;
+    }
+    f.jain = sum_sq > 0 ? sum * sum / (per_workgroup.size() * sum_sq) : 1;
+    return f;
+}
+
+// Per-iteration fairness metrics plus their means, and the extremes over all iterations
+json fairness_report(const vector<Fairness>& fairness) {
+    vector<double> min, max, cv, jain;
+    for (auto& f : fairness) {
+        min.push_back(f.min);
+        max.push_back(f.max);
+        cv.push_back(f.cv);
+        jain.push_back(f.jain);
+    }
+    return {
+        {"min", min},
+        {"max", max},
+        {"cv", cv},
+        {"jain", jain},
+        {"min-overall", min.empty() ? 0 : *std::min_element(min.begin(), min.end())},
+        {"max-overall", max.empty() ? 0 : *std::max_element(max.begin(), max.end())},
+        {"cv-mean", mean(cv)},
+        {"jain-mean", mean(jain)}
+    };
+}
+
+// Buckets of the acquire-latency histogram: bucket b holds latencies of bit length b, so [2^(b-1), 2^b) ticks
+const uint32_t latency_buckets = 33;
+
+// Exclusive upper bound, in ticks, of the bucket where the cumulative count first reaches `fraction` of the total
+uint64_t histogram_percentile(const vector<uint64_t>& histogram, double fraction) {
+    uint64_t total = std::accumulate(histogram.begin(), histogram.end(), (uint64_t)0);
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < histogram.size(); b++) {
+        seen += histogram[b];
+        if (total > 0 && seen >= fraction * total)
+            return (uint64_t)1 << b;
+    }
+    return 0;
+}
+
+// Percentiles are bucket upper bounds, so they are accurate to a factor of two
+json latency_report(const vector<uint64_t>& histogram) {
+    uint64_t max = 0;
+    for (uint32_t b = 0; b < histogram.size(); b++) {
+        if (histogram[b] > 0)
+            max = (uint64_t)1 << b;
+    }
+    return {
+        {"histogram", histogram},
+        {"p50-ticks", histogram_percentile(histogram, 0.50)},
+        {"p90-ticks", histogram_percentile(histogram, 0.90)},
+        {"p99-ticks", histogram_percentile(histogram, 0.99)},
+        {"max-ticks", max}
+    };
+}
+
+json summary_json(const Summary& summary) {
+    return {
+        {"n", summary.n},
+        {"mean", summary.mean},
+        {"stddev", summary.stddev},
+        {"median", summary.median},
+        {"min", summary.min},
+        {"max", summary.max},
+        {"ci95-low", summary.ci95_low},
+        {"ci95-high", summary.ci95_high},
+        {"outliers", summary.outliers}
+    };
+}
+
+char* to_cstring(const json& j) {
+    string json_string = j.dump();
+    char* json_cstring = new char[json_string.size() + 1];
+    copy(json_string.data(), json_string.data() + json_string.size() + 1, json_cstring);
+    return json_cstring;
+}
+
+// Accepts a device index, a type (discrete, integrated, virtual, cpu, other) or a name substring.
+// An empty selector picks the first device.
+Device select_device(Instance& instance, const string& selector) {
+    if (selector.empty())
+        return instance.selectDevice(0u);
+    if (selector.find_first_not_of("0123456789") == string::npos)
+        return instance.selectDevice((uint32_t)std::stoul(selector));
+    if (selector == "discrete")
+        return instance.selectDevice(VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU);
+    if (selector == "integrated")
+        return instance.selectDevice(VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU);
+    if (selector == "virtual")
+        return instance.selectDevice(VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU);
+    if (selector == "cpu")
+        return instance.selectDevice(VK_PHYSICAL_DEVICE_TYPE_CPU);
+    if (selector == "other")
+        return instance.selectDevice(VK_PHYSICAL_DEVICE_TYPE_OTHER);
+    return instance.selectDevice(selector);
+}
+
+// select_device for a session's constructor: Instance has no destructor, so if no device matches, the
+// instance is torn down here before the half-built session unwinds past it
+Device select_session_device(Instance& instance, const string& selector) {
+    try {
+        return select_device(instance, selector);
+    } catch (...) {
+        instance.teardown();
+        throw;
+    }
+}
+
+// Slice used by the timed strategy; the host regains control this often while the GPU runs
+const uint64_t wait_timeout_ns = 1000000;
+
+// Words per invocation in the garbage buffer; matches GARBAGE_STRIDE in lock_harness.cl
+const uint32_t garbage_stride = 4;
+
+// The trailing scalar arguments of lock_test in lock_harness.cl, in order, which clspv's -pod-pushconstant
+// turns into the kernel's push-constant block
+struct LockPushConstants {
+    uint32_t lock_iters;
+    uint32_t contention;
+
+    bool operator==(const LockPushConstants& other) const {
+        return lock_iters == other.lock_iters && contention == other.contention;
+    }
+};
+
+// Parameters of one LockTestSession::run
+struct RunOptions {
+    uint32_t workgroups;
+    uint32_t workgroup_size;
+    uint32_t lock_iters;
+    uint32_t test_iters;
+    Contention contention = Contention::One;
+    WaitStrategy wait_strategy = WaitStrategy::Block;
+    // Names of the locks to run; empty runs every registered lock
+    vector<string> locks;
+    // Overrides for lock parameters, by parameter name
+    std::map<string, uint32_t> params;
+    // Drop workgroups beyond the discovered occupancy; if false, only warn that the run may hang
+    bool cap_to_occupancy = true;
+};
+
+// Zero-sized runs would create empty query pools and result buffers and divide by zero in the report
+const char* invalid_run_shape(uint32_t workgroups, uint32_t workgroup_size, uint32_t lock_iters, uint32_t test_iters) {
+    if (workgroups == 0)
+        return "workgroups must be positive";
+    if (workgroup_size == 0)
+        return "workgroup_size must be positive";
+    if (lock_iters == 0)
+        return "lock_iters must be positive";
+    if (test_iters == 0)
+        return "test_iters must be positive";
+    return nullptr;
+}
+
+enum class SweepFormat {
+    Csv,
+    JsonLines
+};
+
+// A run per point of the cartesian product of the three lists; `base` supplies everything else
+struct SweepOptions {
+    RunOptions base;
+    vector<uint32_t> workgroups;
+    vector<uint32_t> workgroup_sizes;
+    vector<uint32_t> lock_iters;
+};
+
+// A registered lock's compiled program and the buffers bound to it
+struct LockState {
+    const LockSpec* spec;
+    vector<Buffer> buffers;
+    // The spec's private state; null if the lock has none, in which case the session's emptyBuf is bound
+    std::unique_ptr<Buffer> stateBuf;
+    // Holds the spec's parameters; null if the lock has none, in which case the session's emptyBuf is bound
+    std::unique_ptr<Buffer> paramsBuf;
+    std::unique_ptr<Program> program;
+    // Parameters the program was last prepared with; a run with the same ones resubmits without re-recording
+    uint32_t prepared_workgroups = 0;
+    uint32_t prepared_workgroup_size = 0;
+    uint32_t prepared_test_iters = 0;
+    LockPushConstants prepared_constants = {0, 0};
+    // Co-resident workgroups found on this lock's pipeline for each workgroup size
+    std::map<uint32_t, uint32_t> occupancy;
+};
+
+vector<uint32_t> occupancy_spv() { return
+    #include "occupancy.cinit"
     ;
+}
 
-    Program tasProgram = Program(device, tasSpvCode, buffers);
-    tasProgram.setWorkgroups(workgroups);
-    tasProgram.setWorkgroupSize(workgroup_size);
-    tasProgram.prepare();
-    uint32_t tas_failures = 0;
+// Dispatches of the discovery kernel per workgroup size; residency can vary between dispatches
+const uint32_t occupancy_trials = 4;
+// Workgroups each discovery dispatch launches, within the device's limit; more than any GPU keeps resident
+const uint32_t occupancy_probe_workgroups = 8192;
 
-    for (int i = 1; i <= test_iters; i++) {
-        log("  Test %d: ", i);
-        lockBuf.clear();
-        resultBuf.clear();
+// Vulkan state kept alive across runs, so repeated runs only pay for recording and dispatching
+struct LockTestSession {
+    Instance instance;
+    Device device;
+    Buffer lockBuf;
+    Buffer resultBuf;
+    Buffer garbageBuf;
+    // Per-workgroup acquisitions within the fairness window, one word for each workgroup run() allows
+    Buffer acquisitionsBuf;
+    // Acquire-latency histogram written by the latency variants (see LOCK_CLOCK in lock_harness.cl)
+    Buffer histogramBuf;
+    // Per workgroup, the 64-bit sum and the maximum of lock() retries per acquisition
+    Buffer retriesBuf;
+    // Bound in place of the state and params buffers of locks that have none
+    Buffer emptyBuf;
+    // Ticket lock, poll and result of the occupancy discovery kernel (see occupancy_poll.cl)
+    Buffer discoveryBuf;
+    // discoveryBuf's slots, one per trial
+    std::unique_ptr<Buffer> discoverySlotsBuf;
+    vector<Buffer> discoveryBuffers;
+    // Built on first use
+    std::unique_ptr<Program> occupancyProgram;
+    // Co-resident workgroups found for each workgroup size
+    std::map<uint32_t, uint32_t> occupancy;
+    // One result slot per test iteration; replaced, and the programs rebuilt, when a run needs more slots
+    std::unique_ptr<Buffer> iterResultsBuf;
+    // acquisitionsBuf's slots, one per test iteration
+    std::unique_ptr<Buffer> iterAcquisitionsBuf;
+    // histogramBuf's slots, one per test iteration
+    std::unique_ptr<Buffer> iterHistogramBuf;
+    // retriesBuf's slots, one per test iteration
+    std::unique_ptr<Buffer> iterRetriesBuf;
+    // Clock the latency variants are built for; None if the device has no shader clock, which skips them
+    LockClock clock = LockClock::None;
+    // Contenders the lock state buffers are sized for; the programs are rebuilt when a run needs more
+    uint32_t contender_capacity = 0;
+    // Every registered lock, compiled once; runs pick a subset
+    vector<std::unique_ptr<LockState>> locks;
+    uint32_t runs = 0;
 
-        tasProgram.run();
+    LockTestSession(const string& device_selector);
+    char* run(const RunOptions& options);
+    json run_report(const RunOptions& options);
+    // Writes one row per lock and point as each point finishes, so a sweep cut short keeps its results;
+    // a point that fails gets a row with its error instead of ending the sweep
+    void sweep(const SweepOptions& options, SweepFormat format, FILE* output);
+    void teardown();
 
-        uint32_t result = resultBuf.load(0);
-        uint32_t test_failures = (lock_iters * workgroups) - result;
-        float test_percent = (float)test_failures / (float)test_total * 100;
+  private:
+    uint32_t discover_occupancy(uint32_t workgroup_size);
+    uint32_t discover_lock_occupancy(LockState& lock, const RunOptions& options);
+    void reserve(uint32_t test_iters, uint32_t contender_bound);
+    void build_programs(uint32_t test_iters, uint32_t contenders);
+    uint32_t contenders(const RunOptions& options);
+    void teardown_programs();
+    void prepare_lock(LockState& lock, const RunOptions& options);
+    json report_lock(LockState& lock, Submission& submission, const RunOptions& options);
+    json log_throughput_ranking(const json& result_json, const vector<LockState*>& selected);
+    json log_order_comparison(const json& result_json, const vector<LockState*>& selected);
+};
 
-        #ifndef __ANDROID__
-        if (test_percent > 10.0)
-            log("\u001b[31m");
-        else if (test_percent > 5.0)
-            log("\u001b[33m");
-        else
-            log("\u001b[32m");
-        #endif
-        log("%d / %d, %.2f%%\n", test_failures, test_total, test_percent);
-        #ifndef __ANDROID__
-        log('\u001b[0m');
-        #endif
-        tas_failures += test_failures;
+// The contended words live in device memory so host-visible placement doesn't skew the measurement.
+// The garbage buffer is sized for the largest workgroup the device allows, so it never needs to grow.
+LockTestSession::LockTestSession(const string& device_selector) :
+    instance(false),
+    device(select_session_device(instance, device_selector)),
+    lockBuf(device, 1, MemoryPolicy::DeviceLocal),
+    resultBuf(device, 2, MemoryPolicy::DeviceLocal),
+    garbageBuf(device, device.properties.limits.maxComputeWorkGroupInvocations * garbage_stride, MemoryPolicy::DeviceLocal),
+    acquisitionsBuf(device, device.properties.limits.maxComputeWorkGroupInvocations, MemoryPolicy::DeviceLocal),
+    histogramBuf(device, latency_buckets, MemoryPolicy::DeviceLocal),
+    retriesBuf(device, device.properties.limits.maxComputeWorkGroupInvocations * 3, MemoryPolicy::DeviceLocal),
+    emptyBuf(device, 1, MemoryPolicy::DeviceLocal),
+    discoveryBuf(device, 4, MemoryPolicy::DeviceLocal) {
+    for (auto& info : instance.physicalDevices())
+        log("Device %d: '%s' (%s)\n", info.index, info.properties.deviceName, vkDeviceType(info.properties.deviceType));
+    log("Using device '%s'\n", device.properties.deviceName);
+    log("Pipeline cache: %s\n", device.pipelineCacheHit ? "hit" : "miss");
+    log("Lock memory: %s\n", memory_flags_string(lockBuf).c_str());
+    auto& capabilities = device.capabilities;
+    log("Capabilities: memory model %s, subgroup size %d%s, shader clock %s, int64 atomics %s, timestamps %d bits\n",
+        capabilities.vulkanMemoryModel ? capabilities.vulkanMemoryModelDeviceScope ? "yes" : "without device scope" : "no", capabilities.subgroupSize, capabilities.subgroupCompute ? "" : " (not in compute)",
+        capabilities.shaderDeviceClock ? "device" : capabilities.shaderSubgroupClock ? "subgroup" : "no",
+        capabilities.shaderBufferInt64Atomics ? "yes" : "no", capabilities.timestampValidBits);
+    if (memory_model_missing(capabilities))
+        log("Device has %s; only relaxed lock variants will run\n", memory_model_missing(capabilities));
+    // The device clock is comparable across workgroups; the subgroup clock still times one acquisition correctly
+    if (capabilities.shaderDeviceClock)
+        clock = LockClock::Device;
+    else if (capabilities.shaderSubgroupClock)
+        clock = LockClock::Subgroup;
+    else
+        log("No shader clock; latency variants will not run\n");
+}
+
+void LockTestSession::build_programs(uint32_t test_iters, uint32_t contenders) {
+    teardown_programs();
+    iterResultsBuf.reset(new Buffer(device, resultBuf.count() * test_iters, MemoryPolicy::HostCached));
+    iterAcquisitionsBuf.reset(new Buffer(device, acquisitionsBuf.count() * test_iters, MemoryPolicy::HostCached));
+    iterHistogramBuf.reset(new Buffer(device, latency_buckets * test_iters, MemoryPolicy::HostCached));
+    iterRetriesBuf.reset(new Buffer(device, retriesBuf.count() * test_iters, MemoryPolicy::HostCached));
+    contender_capacity = contenders;
+    for (auto& spec : lock_registry()) {
+        if (spec.needs_vulkan_memory_model() && memory_model_missing(device.capabilities))
+            continue;
+        if (spec.latency && clock == LockClock::None)
+            continue;
+        std::unique_ptr<LockState> lock(new LockState());
+        lock->spec = &spec;
+        lock->buffers.push_back(lockBuf);
+        lock->buffers.push_back(resultBuf);
+        lock->buffers.push_back(garbageBuf);
+        lock->buffers.push_back(acquisitionsBuf);
+        lock->buffers.push_back(histogramBuf);
+        lock->buffers.push_back(retriesBuf);
+        uint32_t state_words = spec.state_words + spec.state_words_per_contender * contenders;
+        if (state_words > 0)
+            lock->stateBuf.reset(new Buffer(device, state_words, MemoryPolicy::DeviceLocal));
+        lock->buffers.push_back(lock->stateBuf ? *lock->stateBuf : emptyBuf);
+        // Rewritten by prepare_lock while the previous lock runs; host-coherent, so that never waits on a staging copy
+        if (!spec.params.empty())
+            lock->paramsBuf.reset(new Buffer(device, spec.params.size(), MemoryPolicy::HostCoherent));
+        lock->buffers.push_back(lock->paramsBuf ? *lock->paramsBuf : emptyBuf);
+        lock->program.reset(new Program(device, spec.spv_code(spec.order, spec.latency ? clock : LockClock::None), lock->buffers));
+        lock->program->addResetBuffer(lockBuf);
+        lock->program->addResetBuffer(resultBuf);
+        if (lock->stateBuf)
+            lock->program->addResetBuffer(*lock->stateBuf);
+        lock->program->addResetBuffer(acquisitionsBuf);
+        lock->program->addOutputBuffer(resultBuf, *iterResultsBuf);
+        lock->program->addResetBuffer(retriesBuf);
+        lock->program->addOutputBuffer(acquisitionsBuf, *iterAcquisitionsBuf);
+        lock->program->addOutputBuffer(retriesBuf, *iterRetriesBuf);
+        if (spec.latency) {
+            lock->program->addResetBuffer(histogramBuf);
+            lock->program->addOutputBuffer(histogramBuf, *iterHistogramBuf);
+        }
+        locks.push_back(std::move(lock));
+    }
+}
+
+void LockTestSession::teardown_programs() {
+    for (auto& lock : locks) {
+        lock->program->teardown();
+        if (lock->stateBuf)
+            lock->stateBuf->teardown();
+        if (lock->paramsBuf)
+            lock->paramsBuf->teardown();
+    }
+    locks.clear();
+    if (iterResultsBuf) {
+        iterResultsBuf->teardown();
+        iterAcquisitionsBuf->teardown();
+        iterHistogramBuf->teardown();
+        iterRetriesBuf->teardown();
+    }
+}
+
+// The fewest workgroups of `workgroup_size` invocations found co-resident over the discovery trials, or 0 if
+// discovery failed. Spinning on a lock held by a workgroup that isn't resident yet can never finish, so runs
+// stay within this. The discovery kernel uses next to no registers, so this is only an upper bound for the
+// lock kernels; discover_lock_occupancy checks each lock's pipeline against it.
+uint32_t LockTestSession::discover_occupancy(uint32_t workgroup_size) {
+    auto known = occupancy.find(workgroup_size);
+    if (known != occupancy.end())
+        return known->second;
+
+    if (!occupancyProgram) {
+        discoverySlotsBuf.reset(new Buffer(device, discoveryBuf.count() * occupancy_trials, MemoryPolicy::HostCached));
+        discoveryBuffers.push_back(discoveryBuf);
+        occupancyProgram.reset(new Program(device, occupancy_spv(), discoveryBuffers));
+        occupancyProgram->setEntryPoint("occupancy");
+        occupancyProgram->setIterations(occupancy_trials);
+        occupancyProgram->addResetBuffer(discoveryBuf);
+        occupancyProgram->addOutputBuffer(discoveryBuf, *discoverySlotsBuf);
+    }
+    uint32_t probe = std::min(occupancy_probe_workgroups, device.properties.limits.maxComputeWorkGroupCount[0]);
+    occupancyProgram->setWorkgroups(probe);
+    occupancyProgram->setWorkgroupSize(workgroup_size);
+    occupancyProgram->prepare();
+    occupancyProgram->run();
+
+    discoverySlotsBuf->invalidate();
+    uint32_t resident = probe;
+    for (uint32_t i = 0; i < occupancy_trials; i++)
+        resident = std::min(resident, discoverySlotsBuf->load(i * discoveryBuf.count() + 3));
+    // The first workgroup to close the poll has always registered, so anything less means the kernel didn't run;
+    // that isn't cached, so the next run tries again
+    if (resident == 0) {
+        log("Warning: occupancy discovery found no co-resident workgroups of %d invocations\n", workgroup_size);
+        return 0;
     }
-    float tas_failure_percent = (float)tas_failures / (float)total_locks * 100;
-    log("%d / %d failures, about %.2f%%\n", tas_failures, total_locks, tas_failure_percent);
+    log("Occupancy: %d co-resident workgroups of %d invocations\n", resident, workgroup_size);
+    occupancy[workgroup_size] = resident;
+    return resident;
+}
+
+// Like discover_occupancy, but on the lock's own pipeline (see CONTENTION_DISCOVER in lock_harness.cl), whose
+// register and memory use can keep fewer workgroups resident. The trials run through the lock's program and
+// leave their counts in iterRetriesBuf, so no other lock may be in flight.
+uint32_t LockTestSession::discover_lock_occupancy(LockState& lock, const RunOptions& options) {
+    auto known = lock.occupancy.find(options.workgroup_size);
+    if (known != lock.occupancy.end())
+        return known->second;
+
+    uint32_t probe = std::min(occupancy_probe_workgroups, device.properties.limits.maxComputeWorkGroupCount[0]);
+    uint32_t trials = std::min(occupancy_trials, options.test_iters);
+    LockPushConstants constants = {0, contention_discover};
+    lock.program->setWorkgroups(probe);
+    lock.program->setWorkgroupSize(options.workgroup_size);
+    lock.program->setIterations(trials);
+    lock.program->setPushConstants(constants);
+    lock.program->prepare();
+    lock.program->run();
+    // Makes prepare_lock re-record the run's own shape
+    lock.prepared_workgroups = 0;
+
+    iterRetriesBuf->invalidate();
+    uint32_t resident = probe;
+    for (uint32_t i = 0; i < trials; i++)
+        resident = std::min(resident, iterRetriesBuf->load(i * retriesBuf.count() + 3));
+    if (resident == 0) {
+        log("Warning: occupancy discovery found no co-resident workgroups on %s's pipeline\n", lock.spec->label.c_str());
+        return 0;
+    }
+    lock.occupancy[options.workgroup_size] = resident;
+    return resident;
+}
+
+// Rebuilds the programs only if the iteration slots or lock state buffers are too small
+void LockTestSession::reserve(uint32_t test_iters, uint32_t contender_bound) {
+    if (!iterResultsBuf || iterResultsBuf->count() < resultBuf.count() * test_iters || contender_capacity < contender_bound)
+        build_programs(test_iters, contender_bound);
+}
 
+// Invocations expected to take the lock in one dispatch. Devices with variable subgroup sizes may pick another
+// size than the one reported, so report_lock() uses the count the kernel writes back instead.
+uint32_t LockTestSession::contenders(const RunOptions& options) {
+    uint32_t subgroup_size = std::max(device.capabilities.subgroupSize, 1u);
+    switch (options.contention) {
+        case Contention::Subgroup:
+            return options.workgroups * ((options.workgroup_size + subgroup_size - 1) / subgroup_size);
+        case Contention::All:
+            return options.workgroups * options.workgroup_size;
+        default:
+            return options.workgroups;
+    }
+}
 
-    // -------------- TTAS LOCK --------------
+// Writes the lock's parameters and re-records its command buffer only if the dispatch shape or push constants changed
+void LockTestSession::prepare_lock(LockState& lock, const RunOptions& options) {
+    if (lock.paramsBuf) {
+        for (size_t i = 0; i < lock.spec->params.size(); i++) {
+            auto& param = lock.spec->params[i];
+            auto override_value = options.params.find(param.name);
+            lock.paramsBuf->store(i, override_value != options.params.end() ? override_value->second : param.default_value);
+        }
+        lock.paramsBuf->flush();
+    }
 
+    LockPushConstants constants = {options.lock_iters, (uint32_t)options.contention};
+    if (options.workgroups == lock.prepared_workgroups && options.workgroup_size == lock.prepared_workgroup_size
+        && options.test_iters == lock.prepared_test_iters && constants == lock.prepared_constants)
+        return;
+    lock.program->setWorkgroups(options.workgroups);
+    lock.program->setWorkgroupSize(options.workgroup_size);
+    lock.program->setIterations(options.test_iters);
+    lock.program->setPushConstants(constants);
+    lock.program->prepare();
+    lock.prepared_workgroups = options.workgroups;
+    lock.prepared_workgroup_size = options.workgroup_size;
+    lock.prepared_test_iters = options.test_iters;
+    lock.prepared_constants = constants;
+}
+
+// Waits for the lock's submission and summarizes it; keys are prefixed with the lock's name by the caller
+json LockTestSession::report_lock(LockState& lock, Submission& submission, const RunOptions& options) {
     log("----------------------------------------------------------\n");
-    log("Testing TTAS lock...\n");
-    log("%d workgroups, %d threads per workgroup, %d locks per thread, tests run %d times.\n", workgroups, workgroup_size, lock_iters, test_iters);
-    vector<uint32_t> ttasSpvCode =
-    #include "ttas_lock.cinit"
-    ;
-    Program ttasProgram = Program(device, ttasSpvCode, buffers);
-    ttasProgram.setWorkgroups(workgroups);
-    ttasProgram.setWorkgroupSize(workgroup_size);
-    ttasProgram.prepare();
-    uint32_t ttas_failures = 0;
+    log("Testing %s lock...\n", lock.spec->label.c_str());
+    log("%d workgroups, %d threads per workgroup, %d locks per contender, tests run %d times.\n",
+        options.workgroups, options.workgroup_size, options.lock_iters, options.test_iters);
+    // Totals are signed and 64-bit so a lost or duplicated acquisition can't wrap the failure count
+    int64_t failures = 0;
+    int64_t total_locks = 0;
+    int64_t test_total = 0;
 
-    for (int i = 1; i <= test_iters; i++) {
-        log("  Test %d: ", i);
-        lockBuf.clear();
-        resultBuf.clear();
+    while (!submission.wait(options.wait_strategy, wait_timeout_ns));
+    double latency_us = submission.latencyUs();
+    log("Submit-to-completion latency: %.0f us\n", latency_us);
+    vector<double> times_ms = kernel_times_ms(*lock.program);
+    iterResultsBuf->invalidate();
+    iterAcquisitionsBuf->invalidate();
+    iterRetriesBuf->invalidate();
+    vector<Fairness> fairness;
+    vector<double> failures_per_test;
+    vector<double> retries_per_acquire;
+    uint32_t retries_max = 0;
+
+    // Contenders the kernel actually ran with; see res[1] in lock_harness.cl
+    uint32_t run_contenders = iterResultsBuf->load(1);
+    if (run_contenders != contenders(options))
+        log("The device ran %d contenders where %d were expected; using its count\n", run_contenders, contenders(options));
+    log("Contention: %s, %d contenders\n", contention_name(options.contention), run_contenders);
 
-        ttasProgram.run();
+    for (uint32_t i = 1; i <= options.test_iters; i++) {
+        log("  Test %d: ", i);
 
-        uint32_t result = resultBuf.load(0);
-        uint32_t test_failures = (lock_iters * workgroups) - result;
-        float test_percent = (float)test_failures / (float)test_total * 100;
+        test_total = (int64_t)iterResultsBuf->load((i - 1) * resultBuf.count() + 1) * options.lock_iters;
+        int64_t result = iterResultsBuf->load((i - 1) * resultBuf.count());
+        int64_t test_failures = test_total - result;
+        double test_percent = test_total > 0 ? (double)test_failures / test_total * 100 : 0;
 
         #ifndef __ANDROID__
         if (test_percent > 10.0)
@@ -161,101 +697,758 @@ extern "C" char* run(uint32_t workgroups, uint32_t workgroup_size, uint32_t lock
         else
             log("\u001b[32m");
         #endif
-        log("%d / %d, %.2f%%\n", test_failures, test_total, test_percent);
+        log("%lld / %lld, %.2f%%", (long long)test_failures, (long long)test_total, test_percent);
         #ifndef __ANDROID__
-        log('\u001b[0m');
+        log("\u001b[0m");
         #endif
-        ttas_failures += test_failures;
+        if (!times_ms.empty())
+            log(", %.3f ms", times_ms[i - 1]);
+        vector<double> per_workgroup(options.workgroups);
+        for (uint32_t g = 0; g < options.workgroups; g++)
+            per_workgroup[g] = iterAcquisitionsBuf->load((i - 1) * acquisitionsBuf.count() + g);
+        fairness.push_back(compute_fairness(per_workgroup));
+        log(", fairness %.3f", fairness.back().jain);
+        uint64_t test_retries = 0;
+        for (uint32_t g = 0; g < options.workgroups; g++) {
+            size_t slot = (i - 1) * retriesBuf.count() + 3 * g;
+            test_retries += iterRetriesBuf->load(slot) | (uint64_t)iterRetriesBuf->load(slot + 1) << 32;
+            retries_max = std::max(retries_max, iterRetriesBuf->load(slot + 2));
+        }
+        retries_per_acquire.push_back(test_total > 0 ? (double)test_retries / test_total : 0);
+        log(", %.1f retries/acquire", retries_per_acquire.back());
+        log("\n");
+        failures += test_failures;
+        total_locks += test_total;
+        failures_per_test.push_back(test_failures);
+    }
+    double failure_percent = total_locks > 0 ? (double)failures / total_locks * 100 : 0;
+    log("%lld / %lld failures, about %.2f%%\n", (long long)failures, (long long)total_locks, failure_percent);
+    double time_mean_ms = mean(times_ms);
+    double time_stddev_ms = stddev(times_ms);
+    double acquisitions = acquisitions_per_second(total_locks / options.test_iters, times_ms);
+    log("Kernel time %.3f ms (stddev %.3f ms), %.0f acquisitions/s\n", time_mean_ms, time_stddev_ms, acquisitions);
+
+    json fairness_json = fairness_report(fairness);
+    log("Fairness: Jain's index %.3f, coefficient of variation %.3f\n",
+        fairness_json["jain-mean"].get<double>(), fairness_json["cv-mean"].get<double>());
+
+    log("Retries per acquire: %.2f on average, %d at most\n", mean(retries_per_acquire), retries_max);
+
+    // Every per-iteration metric, summarized so differences between runs can be checked for significance
+    vector<double> jain, cv;
+    for (auto& f : fairness) {
+        jain.push_back(f.jain);
+        cv.push_back(f.cv);
+    }
+    Summary failure_summary = summarize(failures_per_test);
+    Summary time_summary = summarize(times_ms);
+    json summaries = {
+        {"failures", summary_json(failure_summary)},
+        {"kernel-time-ms", summary_json(time_summary)},
+        {"fairness-jain", summary_json(summarize(jain))},
+        {"fairness-cv", summary_json(summarize(cv))},
+        {"retries-per-acquire", summary_json(summarize(retries_per_acquire))}
+    };
+    log("Failures per test: median %.0f, 95%% CI [%.1f, %.1f], %zu outliers\n",
+        failure_summary.median, failure_summary.ci95_low, failure_summary.ci95_high, failure_summary.outliers.size());
+    if (time_summary.n > 0)
+        log("Kernel time: median %.3f ms, 95%% CI [%.3f, %.3f] ms, %zu outliers\n",
+            time_summary.median, time_summary.ci95_low, time_summary.ci95_high, time_summary.outliers.size());
+
+    json latency_json;
+    if (lock.spec->latency) {
+        vector<uint64_t> histogram(latency_buckets, 0);
+        iterHistogramBuf->invalidate();
+        for (uint32_t i = 0; i < options.test_iters; i++) {
+            for (uint32_t b = 0; b < latency_buckets; b++)
+                histogram[b] += iterHistogramBuf->load(i * latency_buckets + b);
+        }
+        latency_json = latency_report(histogram);
+        log("Acquire latency (%s clock ticks): p50 < %llu, p90 < %llu, p99 < %llu, max < %llu\n",
+            clock == LockClock::Device ? "device" : "subgroup",
+            latency_json["p50-ticks"].get<unsigned long long>(), latency_json["p90-ticks"].get<unsigned long long>(),
+            latency_json["p99-ticks"].get<unsigned long long>(), latency_json["max-ticks"].get<unsigned long long>());
+        latency_json["clock"] = clock == LockClock::Device ? "device" : "subgroup";
     }
-    float ttas_failure_percent = (float)ttas_failures / (float)total_locks * 100;
-    log("%d / %d failures, about %.2f%%\n", ttas_failures, total_locks, ttas_failure_percent);
 
-    // -------------- CAS LOCK --------------
+    json report = {
+        {"label", lock.spec->label},
+        {"workgroups", options.workgroups},
+        {"contenders", run_contenders},
+        {"total-locks", total_locks},
+        {"memory-order", lock_order_name(lock.spec->order)},
+        {"failures", failures},
+        {"failure-percent", failure_percent},
+        {"submit-latency-us", latency_us},
+        {"kernel-times-ms", times_ms},
+        {"kernel-time-mean-ms", time_mean_ms},
+        {"kernel-time-stddev-ms", time_stddev_ms},
+        {"acquisitions-per-second", acquisitions},
+        {"fairness", fairness_json},
+        {"retries-per-acquire", retries_per_acquire},
+        {"retries-per-acquire-mean", mean(retries_per_acquire)},
+        {"retries-per-acquire-max", retries_max},
+        {"summary", summaries}
+    };
+    if (lock.spec->latency)
+        report["latency"] = latency_json;
+    if (lock.paramsBuf) {
+        json params = json::object();
+        for (size_t i = 0; i < lock.spec->params.size(); i++)
+            params[lock.spec->params[i].name] = lock.paramsBuf->load(i);
+        report["params"] = params;
+    }
+    return report;
+}
 
+char* LockTestSession::run(const RunOptions& options) {
+    return to_cstring(run_report(options));
+}
+
+json LockTestSession::run_report(const RunOptions& requested) {
+    if (const char* invalid = invalid_run_shape(requested.workgroups, requested.workgroup_size, requested.lock_iters, requested.test_iters))
+        throw runtime_error(invalid);
+    log("Initializing test...\n");
+    runs++;
+    RunOptions options = requested;
+
+    // The per-workgroup acquisition and retry counters have a slot for up to maxComputeWorkGroupInvocations workgroups
+    uint32_t maxComputeWorkGroupInvocations = device.properties.limits.maxComputeWorkGroupInvocations;
+    log("MaxComputeWorkGroupInvocations: %d\n", maxComputeWorkGroupInvocations);
+    if (options.workgroups > maxComputeWorkGroupInvocations)
+        options.workgroups = maxComputeWorkGroupInvocations;
+    if (options.workgroup_size > maxComputeWorkGroupInvocations)
+        options.workgroup_size = maxComputeWorkGroupInvocations;
+
+    uint32_t resident = discover_occupancy(options.workgroup_size);
+    if (resident == 0 && options.cap_to_occupancy)
+        throw runtime_error("Occupancy discovery failed, so there is no safe number of workgroups; disable the occupancy cap to run anyway");
+    else if (resident == 0)
+        log("Warning: running %d workgroups without a known occupancy; the run may hang\n", options.workgroups);
+    bool over_occupancy = resident > 0 && options.workgroups > resident;
+    if (over_occupancy && options.cap_to_occupancy) {
+        log("Capping %d workgroups to the %d found co-resident\n", options.workgroups, resident);
+        options.workgroups = resident;
+    } else if (over_occupancy) {
+        log("Warning: %d workgroups exceed the %d found co-resident; the run may hang\n", options.workgroups, resident);
+    }
+
+    if (options.contention == Contention::Subgroup && !device.capabilities.subgroupCompute) {
+        log("Subgroups are unavailable in compute shaders; contending once per workgroup\n");
+        options.contention = Contention::One;
+    }
+    uint32_t run_contenders = contenders(options);
+    // Expected from the reported subgroup size; each lock's report carries the counts its kernel observed
+    int64_t total_locks = (int64_t)run_contenders * options.lock_iters * options.test_iters;
+    // Invocations of one subgroup spinning on each other can livelock on GPUs without independent forward progress
+    if (options.contention == Contention::All && options.workgroup_size > 1)
+        log("Warning: all-invocation contention can hang devices that lack independent forward progress\n");
+
+    // State buffers are sized for the widest contention this shape allows, so switching modes doesn't rebuild
+    reserve(options.test_iters, options.workgroups * options.workgroup_size);
+
+    for (auto& name : options.locks) {
+        const LockSpec* spec = find_lock(name);
+        if (spec == nullptr)
+            log("Unknown lock '%s', skipping\n", name.c_str());
+        else if (spec->needs_vulkan_memory_model() && memory_model_missing(device.capabilities))
+            log("Lock '%s' needs the Vulkan memory model at device scope and the device has %s, skipping\n",
+                name.c_str(), memory_model_missing(device.capabilities));
+    }
+    vector<LockState*> candidates;
+    for (auto& lock : locks) {
+        if (options.locks.empty() || std::find(options.locks.begin(), options.locks.end(), lock->spec->name) != options.locks.end())
+            candidates.push_back(lock.get());
+    }
+    // Each lock runs within what its own pipeline keeps resident, which the count above only bounds; all
+    // discovery happens here because it shares the result buffers with the runs below
+    vector<LockState*> selected;
+    vector<RunOptions> lock_options;
+    for (LockState* lock : candidates) {
+        RunOptions lock_run = options;
+        uint32_t lock_resident = discover_lock_occupancy(*lock, options);
+        if (lock_resident == 0 && options.cap_to_occupancy) {
+            log("Skipping %s, since occupancy discovery failed on its pipeline\n", lock->spec->label.c_str());
+            continue;
+        }
+        if (lock_resident > 0 && lock_resident < resident)
+            log("%s's pipeline keeps %d workgroups co-resident, fewer than the discovery kernel's %d\n",
+                lock->spec->label.c_str(), lock_resident, resident);
+        if (lock_resident > 0 && options.workgroups > lock_resident) {
+            if (options.cap_to_occupancy) {
+                log("Capping %s to %d workgroups\n", lock->spec->label.c_str(), lock_resident);
+                lock_run.workgroups = lock_resident;
+            } else
+                log("Warning: %d workgroups exceed the %d %s keeps co-resident; the run may hang\n",
+                    options.workgroups, lock_resident, lock->spec->label.c_str());
+        }
+        selected.push_back(lock);
+        lock_options.push_back(lock_run);
+    }
+
+    json result_json = {
+        {"os-name", os_name()},
+        {"device-name", device.properties.deviceName},
+        {"device-type", vkDeviceType(device.properties.deviceType)},
+        {"workgroups", options.workgroups},
+        {"requested-workgroups", requested.workgroups},
+        {"occupancy", resident},
+        {"occupancy-capped", over_occupancy && options.cap_to_occupancy},
+        {"workgroup-size", options.workgroup_size},
+        {"lock-iters", options.lock_iters},
+        {"test-iters", options.test_iters},
+        {"contention", contention_name(options.contention)},
+        {"contenders", run_contenders},
+        {"total-locks", total_locks},
+        {"session-run", runs},
+        {"wait-strategy", wait_strategy_name(options.wait_strategy)},
+        {"pipeline-cache-hit", device.pipelineCacheHit},
+        {"capabilities", capabilities_json(device.capabilities)}
+    };
+    json lock_names = json::array();
+
+    // Each lock's program has its own command buffer, so the next lock is prepared while the
+    // current one runs; locks whose dispatch shape is unchanged are resubmitted without re-recording.
+    if (!selected.empty())
+        prepare_lock(*selected[0], lock_options[0]);
+    for (size_t i = 0; i < selected.size(); i++) {
+        LockState& lock = *selected[i];
+        Submission submission = lock.program->runAsync();
+        if (i + 1 < selected.size())
+            prepare_lock(*selected[i + 1], lock_options[i + 1]);
+
+        json lock_report = report_lock(lock, submission, lock_options[i]);
+        auto lock_resident = lock.occupancy.find(options.workgroup_size);
+        lock_report["occupancy"] = lock_resident != lock.occupancy.end() ? json(lock_resident->second) : json();
+        for (auto& item : lock_report.items())
+            result_json[lock.spec->name + "-" + item.key()] = item.value();
+        lock_names.push_back(lock.spec->name);
+    }
+    result_json["locks"] = lock_names;
+    result_json["throughput-ranking"] = log_throughput_ranking(result_json, selected);
+    result_json["memory-order-comparison"] = log_order_comparison(result_json, selected);
+
+    uint32_t memory_allocations = device.arena.blockCount();
     log("----------------------------------------------------------\n");
-    log("Testing CAS lock...\n");
-    log("%d workgroups, %d threads per workgroup, %d locks per thread, tests run %d times.\n", workgroups, workgroup_size, lock_iters, test_iters);
-    vector<uint32_t> casSpvCode =
-    #include "cas_lock.cinit"
-    ;
-    Program casProgram = Program(device, casSpvCode, buffers);
-    casProgram.setWorkgroups(workgroups);
-    casProgram.setWorkgroupSize(workgroup_size);
-    casProgram.prepare();
-    uint32_t cas_failures = 0;
+    log("%d device memory allocations backed all buffers\n", memory_allocations);
+    result_json["device-memory-allocations"] = memory_allocations;
+    result_json["lock-memory"] = memory_flags_string(lockBuf);
+    // The app's process can be killed without a teardown, so new pipelines are saved as soon as a run built them
+    device.syncPipelineCache();
 
-    for (int i = 1; i <= test_iters; i++) {
-        log("  Test %d: ", i);
-        lockBuf.clear();
-        resultBuf.clear();
+    return result_json;
+}
 
-        casProgram.run();
+// Columns of the sweep table, in order; the lock's own columns are read from its report under the same name.
+// "error" is only set on the single row written for a point that failed.
+const vector<string> sweep_columns = {
+    "workgroups", "occupancy", "workgroup-size", "lock-iters", "test-iters", "contention", "contenders", "lock", "memory-order",
+    "failures", "failure-percent", "kernel-time-mean-ms", "kernel-time-stddev-ms", "kernel-time-ci95-low-ms",
+    "kernel-time-ci95-high-ms", "acquisitions-per-second", "fairness-jain", "retries-per-acquire-mean",
+    "retries-per-acquire-max", "latency-p50-ticks", "latency-p99-ticks", "error"
+};
 
-        uint32_t result = resultBuf.load(0);
-        uint32_t test_failures = (lock_iters * workgroups) - result;
-        float test_percent = (float)test_failures / (float)test_total * 100;
+// A column of the table, or null if this lock doesn't report it
+json sweep_value(const json& result_json, const string& lock, const string& column) {
+    const string prefix = lock + "-";
+    if (column == "lock")
+        return lock.empty() ? json() : json(lock);
+    if (column == "kernel-time-ci95-low-ms" || column == "kernel-time-ci95-high-ms") {
+        const json& summary = result_json[prefix + "summary"]["kernel-time-ms"];
+        return summary["n"].get<size_t>() > 1 ? summary[column == "kernel-time-ci95-low-ms" ? "ci95-low" : "ci95-high"] : json();
+    }
+    if (column == "fairness-jain")
+        return result_json[prefix + "fairness"]["jain-mean"];
+    if (column == "latency-p50-ticks" || column == "latency-p99-ticks") {
+        if (!result_json.contains(prefix + "latency"))
+            return json();
+        return result_json[prefix + "latency"][column == "latency-p50-ticks" ? "p50-ticks" : "p99-ticks"];
+    }
+    if (result_json.contains(prefix + column))
+        return result_json[prefix + column];
+    return result_json.contains(column) ? result_json[column] : json();
+}
 
-        #ifndef __ANDROID__
-        if (test_percent > 10.0)
-            log("\u001b[31m");
-        else if (test_percent > 5.0)
-            log("\u001b[33m");
+// A string cell as CSV, quoted if it holds a separator or quote; error messages can
+string csv_quote(const string& text) {
+    if (text.find_first_of(",\"\n") == string::npos)
+        return text;
+    string quoted = "\"";
+    for (char c : text)
+        quoted += c == '"' ? "\"\"" : string(1, c);
+    return quoted + "\"";
+}
+
+void LockTestSession::sweep(const SweepOptions& options, SweepFormat format, FILE* output) {
+    // Size the state buffers for the largest point up front, so no point in between rebuilds the programs
+    uint32_t max_invocations = device.properties.limits.maxComputeWorkGroupInvocations;
+    uint32_t max_workgroups = std::min(*std::max_element(options.workgroups.begin(), options.workgroups.end()), max_invocations);
+    uint32_t max_size = std::min(*std::max_element(options.workgroup_sizes.begin(), options.workgroup_sizes.end()), max_invocations);
+    reserve(options.base.test_iters, max_workgroups * max_size);
+
+    size_t points = options.workgroups.size() * options.workgroup_sizes.size() * options.lock_iters.size();
+    log("Sweeping %zu points\n", points);
+    if (format == SweepFormat::Csv) {
+        for (size_t c = 0; c < sweep_columns.size(); c++)
+            fprintf(output, "%s%s", c > 0 ? "," : "", sweep_columns[c].c_str());
+        fprintf(output, "\n");
+    }
+
+    // Workgroup size is outermost since only it re-specializes the pipelines; a new workgroup count
+    // or lock_iters only re-records the command buffers.
+    size_t point = 0;
+    for (uint32_t workgroup_size : options.workgroup_sizes) {
+        for (uint32_t workgroups : options.workgroups) {
+            for (uint32_t lock_iters : options.lock_iters) {
+                RunOptions run_options = options.base;
+                run_options.workgroups = workgroups;
+                run_options.workgroup_size = workgroup_size;
+                run_options.lock_iters = lock_iters;
+                log("Sweep point %zu / %zu: %d workgroups of %d, %d locks per contender\n",
+                    ++point, points, workgroups, workgroup_size, lock_iters);
+                // A failed point gets one row carrying its error, and the sweep goes on to the next
+                json result_json;
+                try {
+                    result_json = run_report(run_options);
+                } catch (const std::exception& e) {
+                    log("Sweep point %zu failed: %s\n", point, e.what());
+                    result_json = {
+                        {"workgroups", workgroups},
+                        {"workgroup-size", workgroup_size},
+                        {"lock-iters", lock_iters},
+                        {"test-iters", run_options.test_iters},
+                        {"contention", contention_name(run_options.contention)},
+                        {"error", e.what()},
+                        {"locks", json::array({""})}
+                    };
+                }
+
+                for (auto& lock : result_json["locks"]) {
+                    json row = json::object();
+                    for (auto& column : sweep_columns)
+                        row[column] = sweep_value(result_json, lock.get<string>(), column);
+                    if (format == SweepFormat::JsonLines) {
+                        fprintf(output, "%s\n", row.dump().c_str());
+                        continue;
+                    }
+                    for (size_t c = 0; c < sweep_columns.size(); c++) {
+                        const json& value = row[sweep_columns[c]];
+                        string cell = value.is_null() ? "" : value.is_string() ? csv_quote(value.get<string>()) : value.dump();
+                        fprintf(output, "%s%s", c > 0 ? "," : "", cell.c_str());
+                    }
+                    fprintf(output, "\n");
+                }
+                fflush(output);
+            }
+        }
+    }
+}
+
+// Logs the run's locks from fastest to slowest, relative to the fastest, and returns their names in that order
+json LockTestSession::log_throughput_ranking(const json& result_json, const vector<LockState*>& selected) {
+    vector<std::pair<double, const LockSpec*>> ranking;
+    for (auto lock : selected)
+        ranking.push_back({ result_json[lock->spec->name + "-acquisitions-per-second"].get<double>(), lock->spec });
+    std::stable_sort(ranking.begin(), ranking.end(), [](auto& a, auto& b) { return a.first > b.first; });
+
+    json names = json::array();
+    if (ranking.empty())
+        return names;
+    log("----------------------------------------------------------\n");
+    log("Throughput comparison:\n");
+    for (auto& entry : ranking) {
+        double relative = ranking[0].first > 0 ? entry.first / ranking[0].first * 100 : 0;
+        log("  %-20s %12.0f acquisitions/s (%.1f%% of fastest)\n", entry.second->label.c_str(), entry.first, relative);
+        names.push_back(entry.second->name);
+    }
+    return names;
+}
+
+// Logs failures and kernel time of each lock family's memory-order variants side by side, and returns
+// them as {family: {order: {...}}} for families that ran in more than one order
+json LockTestSession::log_order_comparison(const json& result_json, const vector<LockState*>& selected) {
+    json comparison = json::object();
+    for (auto lock : selected) {
+        if (lock->spec->latency)
+            continue;
+        const string& name = lock->spec->name;
+        comparison[lock->spec->family][lock_order_name(lock->spec->order)] = {
+            {"failure-percent", result_json[name + "-failure-percent"]},
+            {"kernel-time-mean-ms", result_json[name + "-kernel-time-mean-ms"]},
+            {"acquisitions-per-second", result_json[name + "-acquisitions-per-second"]}
+        };
+    }
+    for (auto it = comparison.begin(); it != comparison.end();) {
+        if (it->size() < 2)
+            it = comparison.erase(it);
         else
-            log("\u001b[32m");
-        #endif
-        log("%d / %d, %.2f%%\n", test_failures, test_total, test_percent);
-        #ifndef __ANDROID__
-        log('\u001b[0m');
-        #endif
-        cas_failures += test_failures;
+            ++it;
     }
-    float cas_failure_percent = (float)cas_failures / (float)total_locks * 100;
-    log("%d / %d failures, about %.2f%%\n", cas_failures, total_locks, cas_failure_percent);
+    if (comparison.empty())
+        return comparison;
 
     log("----------------------------------------------------------\n");
-    log("Cleaning up...\n");
+    log("Memory order comparison:\n");
+    for (auto& family : comparison.items()) {
+        log("  %s\n", family.key().c_str());
+        for (auto& order : family.value().items()) {
+            log("    %-8s %6.2f%% failures, %.3f ms\n", order.key().c_str(),
+                order.value()["failure-percent"].get<double>(), order.value()["kernel-time-mean-ms"].get<double>());
+        }
+    }
+    return comparison;
+}
 
-    tasProgram.teardown();
-    ttasProgram.teardown();
-    casProgram.teardown();
+void LockTestSession::teardown() {
+    log("Cleaning up...\n");
+    teardown_programs();
 
-    lockItersBuf.teardown();
+    acquisitionsBuf.teardown();
+    histogramBuf.teardown();
+    retriesBuf.teardown();
     resultBuf.teardown();
     lockBuf.teardown();
     garbageBuf.teardown();
-        
+    emptyBuf.teardown();
+    if (occupancyProgram) {
+        occupancyProgram->teardown();
+        discoverySlotsBuf->teardown();
+    }
+    discoveryBuf.teardown();
+
     device.teardown();
     instance.teardown();
+}
 
-    json result_json = {
-        {"os-name", os_name()},
-        {"device-name", device.properties.deviceName},
-        {"device-type", vkDeviceType(device.properties.deviceType)},
-        {"workgroups", workgroups},
-        {"lock-iters", lock_iters},
-        {"test-iters", test_iters},
-        {"total-locks", total_locks},
-        {"tas-failures", tas_failures},
-        {"tas-failure-percent", tas_failure_percent},
-        {"ttas-failures", ttas_failures},
-        {"ttas-failure-percent", ttas_failure_percent},
-        {"cas-failures", cas_failures},
-        {"cas-failure-percent", cas_failure_percent}
-    };
+// Comma-separated lock names; null or empty selects every lock
+vector<string> parse_lock_list(const char* list) {
+    vector<string> names;
+    if (list == nullptr)
+        return names;
+    string remaining(list);
+    size_t pos;
+    while ((pos = remaining.find(',')) != string::npos) {
+        if (pos > 0)
+            names.push_back(remaining.substr(0, pos));
+        remaining.erase(0, pos + 1);
+    }
+    if (!remaining.empty())
+        names.push_back(remaining);
+    return names;
+}
 
-    string json_string = result_json.dump();
-    char* json_cstring = new char[json_string.size() + 1];
-    copy(json_string.data(), json_string.data() + json_string.size() + 1, json_cstring);
-    return json_cstring;
+// Opens a session on the device matched by `device` (see select_device), or returns null on failure
+// Nothing may throw across the C API, which the app calls over Dart FFI
+extern "C" LockTestSession* session_create(const char* device) {
+    try {
+        return new LockTestSession(device ? device : "");
+    } catch (const std::exception& e) {
+        log("%s\n", e.what());
+        return nullptr;
+    } catch (...) {
+        log("Unknown error opening a session\n");
+        return nullptr;
+    }
+}
+
+// Runs the selected lock tests (comma-separated names, empty for all) in an open session.
+// contention is 0 for one contender per workgroup, 1 for one per subgroup and 2 for every invocation.
+// The result must be released with free_result(); on failure it is {"error": message}.
+extern "C" char* session_run(LockTestSession* session, uint32_t workgroups, uint32_t workgroup_size, uint32_t lock_iters, uint32_t test_iters, uint32_t contention, const char* locks) {
+    if (session == nullptr)
+        return to_cstring({{"error", "no session"}});
+    if (const char* invalid = invalid_run_shape(workgroups, workgroup_size, lock_iters, test_iters)) {
+        log("%s\n", invalid);
+        return to_cstring({{"error", invalid}});
+    }
+    try {
+        RunOptions options;
+        options.workgroups = workgroups;
+        options.workgroup_size = workgroup_size;
+        options.lock_iters = lock_iters;
+        options.test_iters = test_iters;
+        options.contention = contention <= (uint32_t)Contention::All ? (Contention)contention : Contention::One;
+        options.locks = parse_lock_list(locks);
+        return session->run(options);
+    } catch (const std::exception& e) {
+        log("%s\n", e.what());
+        return to_cstring({{"error", e.what()}});
+    } catch (...) {
+        return to_cstring({{"error", "unknown error"}});
+    }
+}
+
+extern "C" void session_destroy(LockTestSession* session) {
+    if (session == nullptr)
+        return;
+    try {
+        session->teardown();
+    } catch (const std::exception& e) {
+        log("%s\n", e.what());
+    } catch (...) {
+        log("Unknown error closing a session\n");
+    }
+    delete session;
+}
+
+// Results are allocated with new[], so they must come back here rather than to the caller's free()
+extern "C" void free_result(char* result) {
+    delete[] result;
+}
+
+// Where compiled pipelines are persisted between runs; the app passes a writable per-app directory
+extern "C" void set_cache_dir(const char* dir) {
+    easyvk::setPipelineCacheDir(dir);
+}
+
+// Properties of every Vulkan device, without creating any logical devices
+extern "C" char* list_devices() {
+    try {
+        Instance instance = Instance(false);
+        json devices = json::array();
+        for (auto& info : instance.physicalDevices()) {
+            devices.push_back({
+                {"index", info.index},
+                {"device-name", info.properties.deviceName},
+                {"device-type", vkDeviceType(info.properties.deviceType)}
+            });
+        }
+        instance.teardown();
+        return to_cstring(devices);
+    } catch (const std::exception& e) {
+        log("%s\n", e.what());
+        return to_cstring({{"error", e.what()}});
+    } catch (...) {
+        log("Unknown error listing devices\n");
+        return to_cstring({{"error", "unknown error"}});
+    }
+}
+
+// Like run(), on the device matched by `device` (see select_device)
+extern "C" char* run_on_device(uint32_t workgroups, uint32_t workgroup_size, uint32_t lock_iters, uint32_t test_iters, const char* device) {
+    LockTestSession* session = session_create(device);
+    if (session == nullptr)
+        return to_cstring({{"error", "could not open a session on the requested device"}});
+    char* result = session_run(session, workgroups, workgroup_size, lock_iters, test_iters, 0, "");
+    session_destroy(session);
+    return result;
+}
+
+extern "C" char* run(uint32_t workgroups, uint32_t workgroup_size, uint32_t lock_iters, uint32_t test_iters) {
+    return run_on_device(workgroups, workgroup_size, lock_iters, test_iters, "");
 }
 
 extern "C" char* run_default() {
     return run(8, 16, 2000, 16);
 }
 
-int main() {
-    char* res = run_default();
-    log("%s\n", res);
-    delete[] res;
-    return 0;
-}
\ No newline at end of file
+const char* bench_usage =
+    "Usage: vk_lock_bench [options]\n"
+    "  --workgroups N         workgroups per dispatch (default 8)\n"
+    "  --workgroup-size N     invocations per workgroup (default 16)\n"
+    "  --lock-iters N         acquisitions per contender (default 2000)\n"
+    "                         These three also take lists and ranges, e.g. 1,2,4 or 8:64:8 or 1:256:x2,\n"
+    "                         and sweep their cartesian product in one session\n"
+    "  --test-iters N         dispatches per lock (default 16)\n"
+    "  --device SELECTOR      device index, type (discrete, integrated, virtual, cpu, other) or name substring\n"
+    "  --locks A,B,...        locks to run (default all)\n"
+    "  --contention MODE      one, subgroup or all (default one)\n"
+    "  --wait STRATEGY        block, poll or timed (default block)\n"
+    "  --param NAME=VALUE     override a lock parameter, e.g. backoff-max=1024; repeatable\n"
+    "  --no-occupancy-cap     run more workgroups than were found co-resident, which may hang\n"
+    "  --format FORMAT        json (one run's report), csv or jsonl (a row per lock and sweep point);\n"
+    "                         defaults to json for one point and csv for a sweep\n"
+    "  --output FILE          write the report to FILE instead of stdout\n"
+    "  --cache-dir DIR        pipeline cache directory (default .)\n"
+    "  --list-devices         print the available devices and exit\n"
+    "  --list-locks           print the registered locks and exit\n";
+
+uint32_t parse_flag_uint(const string& flag, const string& value) {
+    if (value.empty() || value.find_first_not_of("0123456789") != string::npos)
+        throw runtime_error(flag + " expects a non-negative integer, got '" + value + "'");
+    unsigned long parsed = std::stoul(value);
+    if (parsed > UINT32_MAX)
+        throw runtime_error(flag + " is out of range: " + value);
+    return (uint32_t)parsed;
+}
+
+// Comma-separated values and ranges: N, START:END (step 1), START:END:STEP, or START:END:xFACTOR for a geometric range
+vector<uint32_t> parse_flag_values(const string& flag, const string& spec) {
+    vector<uint32_t> values;
+    for (auto& item : parse_lock_list(spec.c_str())) {
+        size_t first = item.find(':');
+        if (first == string::npos) {
+            values.push_back(parse_flag_uint(flag, item));
+            continue;
+        }
+        size_t second = item.find(':', first + 1);
+        uint32_t start = parse_flag_uint(flag, item.substr(0, first));
+        uint32_t end = parse_flag_uint(flag, item.substr(first + 1, second == string::npos ? string::npos : second - first - 1));
+        string step = second == string::npos ? "1" : item.substr(second + 1);
+        bool geometric = !step.empty() && step[0] == 'x';
+        uint32_t by = parse_flag_uint(flag, geometric ? step.substr(1) : step);
+        if (start == 0 && geometric)
+            throw runtime_error(flag + " geometric ranges must start above zero");
+        if (by < (geometric ? 2u : 1u))
+            throw runtime_error(flag + " range step must be " + (geometric ? "at least x2" : "positive") + ": " + item);
+        for (uint64_t v = start; v <= end; v = geometric ? v * by : v + by)
+            values.push_back((uint32_t)v);
+    }
+    if (values.empty())
+        throw runtime_error(flag + " needs at least one value");
+    return values;
+}
+
+// Headless benchmark: runs the selected locks once with the given shape and emits the JSON report,
+// or sweeps several shapes and emits a table
+int main(int argc, char** argv) {
+    SweepOptions sweep_options;
+    RunOptions& options = sweep_options.base;
+    options.test_iters = 16;
+    sweep_options.workgroups = {8};
+    sweep_options.workgroup_sizes = {16};
+    sweep_options.lock_iters = {2000};
+    string device_selector;
+    string output_path;
+    string format;
+    string cache_dir = ".";
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            string flag = argv[i];
+            if (flag == "-h" || flag == "--help") {
+                printf("%s", bench_usage);
+                return 0;
+            }
+            if (flag == "--list-devices") {
+                char* devices = list_devices();
+                printf("%s\n", devices);
+                free_result(devices);
+                return 0;
+            }
+            if (flag == "--list-locks") {
+                for (auto& spec : lock_registry())
+                    printf("%-24s %s\n", spec.name.c_str(), spec.label.c_str());
+                return 0;
+            }
+            if (flag == "--no-occupancy-cap") {
+                options.cap_to_occupancy = false;
+                continue;
+            }
+
+            // Values follow as the next argument or after '='
+            string value;
+            size_t eq = flag.find('=');
+            if (eq != string::npos) {
+                value = flag.substr(eq + 1);
+                flag = flag.substr(0, eq);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                throw runtime_error("Missing value for " + flag);
+            }
+
+            if (flag == "--workgroups")
+                sweep_options.workgroups = parse_flag_values(flag, value);
+            else if (flag == "--workgroup-size")
+                sweep_options.workgroup_sizes = parse_flag_values(flag, value);
+            else if (flag == "--lock-iters")
+                sweep_options.lock_iters = parse_flag_values(flag, value);
+            else if (flag == "--test-iters")
+                options.test_iters = parse_flag_uint(flag, value);
+            else if (flag == "--device")
+                device_selector = value;
+            else if (flag == "--locks")
+                options.locks = parse_lock_list(value.c_str());
+            else if (flag == "--output")
+                output_path = value;
+            else if (flag == "--format") {
+                if (value != "json" && value != "csv" && value != "jsonl")
+                    throw runtime_error("Unknown format '" + value + "'");
+                format = value;
+            }
+            else if (flag == "--cache-dir")
+                cache_dir = value;
+            else if (flag == "--contention") {
+                if (value == "one")
+                    options.contention = Contention::One;
+                else if (value == "subgroup")
+                    options.contention = Contention::Subgroup;
+                else if (value == "all")
+                    options.contention = Contention::All;
+                else
+                    throw runtime_error("Unknown contention '" + value + "'");
+            } else if (flag == "--wait") {
+                if (value == "block")
+                    options.wait_strategy = WaitStrategy::Block;
+                else if (value == "poll")
+                    options.wait_strategy = WaitStrategy::Poll;
+                else if (value == "timed")
+                    options.wait_strategy = WaitStrategy::Timed;
+                else
+                    throw runtime_error("Unknown wait strategy '" + value + "'");
+            } else if (flag == "--param") {
+                size_t sep = value.find('=');
+                if (sep == string::npos || sep == 0)
+                    throw runtime_error("--param expects NAME=VALUE, got '" + value + "'");
+                options.params[value.substr(0, sep)] = parse_flag_uint(flag, value.substr(sep + 1));
+            } else {
+                throw runtime_error("Unknown option " + flag);
+            }
+        }
+        auto has_zero = [](const vector<uint32_t>& values) { return std::find(values.begin(), values.end(), 0u) != values.end(); };
+        if (has_zero(sweep_options.workgroups) || has_zero(sweep_options.workgroup_sizes) || has_zero(sweep_options.lock_iters)
+            || options.test_iters == 0)
+            throw runtime_error("--workgroups, --workgroup-size, --lock-iters and --test-iters must be positive");
+        bool single_point = sweep_options.workgroups.size() == 1 && sweep_options.workgroup_sizes.size() == 1
+            && sweep_options.lock_iters.size() == 1;
+        if (format.empty())
+            format = single_point ? "json" : "csv";
+        else if (format == "json" && !single_point)
+            throw runtime_error("A sweep writes a table; use --format csv or jsonl");
+        options.workgroups = sweep_options.workgroups[0];
+        options.workgroup_size = sweep_options.workgroup_sizes[0];
+        options.lock_iters = sweep_options.lock_iters[0];
+    } catch (const std::exception& e) {
+        fprintf(stderr, "%s\n%s", e.what(), bench_usage);
+        return 2;
+    }
+
+    // Fail before the run rather than after it if the report has nowhere to go
+    FILE* output = stdout;
+    if (!output_path.empty()) {
+        output = fopen(output_path.c_str(), "w");
+        if (output == nullptr) {
+            fprintf(stderr, "Could not open %s for writing\n", output_path.c_str());
+            return 1;
+        }
+    }
+
+    set_cache_dir(cache_dir.c_str());
+    LockTestSession* session = session_create(device_selector.c_str());
+    if (session == nullptr) {
+        if (output != stdout)
+            fclose(output);
+        return 1;
+    }
+    int status = 0;
+    try {
+        if (format == "json") {
+            char* res = session->run(options);
+            fprintf(output, "%s\n", res);
+            free_result(res);
+        } else {
+            session->sweep(sweep_options, format == "csv" ? SweepFormat::Csv : SweepFormat::JsonLines, output);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Lock tests failed: %s\n", e.what());
+        status = 1;
+    } catch (...) {
+        fprintf(stderr, "Lock tests failed\n");
+        status = 1;
+    }
+    if (output != stdout)
+        fclose(output);
+    session_destroy(session);
+    return status;
+}
@@ -1,18 +1,36 @@
 import 'dart:ffi';
 import 'dart:convert';
+import 'dart:io';
 import 'package:flutter/material.dart';
 import 'package:ffi/ffi.dart';
 import 'package:flutter/services.dart';
 import 'package:logcat_monitor/logcat_monitor.dart';
 
 final gpulockLib = DynamicLibrary.open("libgpulock.so");
-final gpulockRun = gpulockLib.lookupFunction<
-    Pointer<Utf8> Function(Uint32, Uint32, Uint32, Uint32),
-    Pointer<Utf8> Function(int, int, int, int)>('run');
+final gpulockSessionCreate = gpulockLib.lookupFunction<
+    Pointer<Void> Function(Pointer<Utf8>),
+    Pointer<Void> Function(Pointer<Utf8>)>('session_create');
+final gpulockSessionRun = gpulockLib.lookupFunction<
+    Pointer<Utf8> Function(
+        Pointer<Void>, Uint32, Uint32, Uint32, Uint32, Uint32, Pointer<Utf8>),
+    Pointer<Utf8> Function(
+        Pointer<Void>, int, int, int, int, int, Pointer<Utf8>)>('session_run');
+final gpulockSessionDestroy = gpulockLib.lookupFunction<
+    Void Function(Pointer<Void>),
+    void Function(Pointer<Void>)>('session_destroy');
+final gpulockFreeResult = gpulockLib.lookupFunction<
+    Void Function(Pointer<Utf8>),
+    void Function(Pointer<Utf8>)>('free_result');
+final gpulockSetCacheDir = gpulockLib.lookupFunction<
+    Void Function(Pointer<Utf8>),
+    void Function(Pointer<Utf8>)>('set_cache_dir');
 
 Map<String, dynamic>? report;
 
 void main() {
+  final cacheDir = Directory.systemTemp.path.toNativeUtf8();
+  gpulockSetCacheDir(cacheDir);
+  malloc.free(cacheDir);
   runApp(const MyApp());
 }
 
@@ -49,6 +67,12 @@ class _MyHomePageState extends State<MyHomePage> {
   String _workgroupSizeField = "";
   String _lockItersField = "";
   String _testItersField = "";
+  // Comma-separated lock names; empty runs every lock
+  String _locksField = "";
+  // Which invocations take the lock, as passed to session_run
+  int _contention = 0;
+  // Native session kept open across runs so only the first run pays for Vulkan setup
+  Pointer<Void> _session = nullptr;
 
   @override
   void initState() {
@@ -60,6 +84,15 @@ class _MyHomePageState extends State<MyHomePage> {
     initPlatformState();
   }
 
+  @override
+  void dispose() {
+    if (_session != nullptr) {
+      gpulockSessionDestroy(_session);
+      _session = nullptr;
+    }
+    super.dispose();
+  }
+
   Future<void> initPlatformState() async {
     LogcatMonitor.clearLogcat;
     try {
@@ -88,11 +121,26 @@ class _MyHomePageState extends State<MyHomePage> {
     _workgroupSize = int.parse(_workgroupSizeField);
     _lockIters = int.parse(_lockItersField);
     _testIters = int.parse(_testItersField);
-    final resultPtr =
-        gpulockRun(_workgroups, _workgroupSize, _lockIters, _testIters);
+    if (_session == nullptr) {
+      final device = "".toNativeUtf8();
+      _session = gpulockSessionCreate(device);
+      malloc.free(device);
+      if (_session == nullptr) {
+        debugPrint('Failed to open a GPU lock test session.');
+        return;
+      }
+    }
+    final locks = _locksField.toNativeUtf8();
+    final resultPtr = gpulockSessionRun(
+        _session, _workgroups, _workgroupSize, _lockIters, _testIters,
+        _contention, locks);
+    malloc.free(locks);
     final result = resultPtr.toDartString();
-    malloc.free(resultPtr);
+    gpulockFreeResult(resultPtr);
     report = jsonDecode(result);
+    if (report?['error'] != null) {
+      debugPrint('Lock tests failed: ${report?['error']}');
+    }
     JsonEncoder encoder = new JsonEncoder.withIndent('  ');
     print(encoder.convert(report));
   }
@@ -123,7 +171,7 @@ class _MyHomePageState extends State<MyHomePage> {
               }),
           TextFormField(
               decoration:
-                  const InputDecoration(labelText: 'Lock attempts per thread'),
+                  const InputDecoration(labelText: 'Lock attempts per contender'),
               keyboardType: TextInputType.number,
               initialValue: _lockItersField,
               onChanged: (val) {
@@ -137,24 +185,26 @@ class _MyHomePageState extends State<MyHomePage> {
               onChanged: (val) {
                 _testItersField = val;
               }),
+          TextFormField(
+              decoration: const InputDecoration(
+                  labelText: 'Locks (comma-separated, empty for all)'),
+              initialValue: _locksField,
+              onChanged: (val) {
+                _locksField = val;
+              }),
+          DropdownButtonFormField<int>(
+              decoration: const InputDecoration(labelText: 'Contention'),
+              value: _contention,
+              items: const [
+                DropdownMenuItem(value: 0, child: Text('One per workgroup')),
+                DropdownMenuItem(value: 1, child: Text('One per subgroup')),
+                DropdownMenuItem(value: 2, child: Text('Every invocation')),
+              ],
+              onChanged: (val) {
+                _contention = val ?? 0;
+              }),
           Divider(color: Colors.black),
-          Text('Report', style: TextStyle(fontWeight: FontWeight.bold)),
-          Text('OS: ${report?['os-name']}'),
-          Text('GPU Name: ${report?['device-name']}'),
-          Text('GPU Type: ${report?['device-type']}'),
-          Text('Workgroups: ${report?['workgroups']}'),
-          Text('Lock attempts per thread: ${report?['lock-iters']}'),
-          Text('Number of tests per lock: ${report?['test-iters']}'),
-          Text('Total lock attempts per lock: ${report?['total-locks']}'),
-          Text('Lock failures (TAS): ${report?['tas-failures']}'),
-          Text(
-              'Lock failure percent (TAS): ${report?['tas-failure-percent']}%'),
-          Text('Lock failures (TTAS): ${report?['ttas-failures']}'),
-          Text(
-              'Lock failure percent (TTAS): ${report?['ttas-failure-percent']}%'),
-          Text('Lock failures (CAS): ${report?['cas-failures']}'),
-          Text(
-              'Lock failure percent (CAS): ${report?['cas-failure-percent']}%'),
+          Expanded(child: reportBuild()),
           Divider(color: Colors.black),
           logboxBuild(context)
         ],
@@ -167,6 +217,60 @@ class _MyHomePageState extends State<MyHomePage> {
     );
   }
 
+  // Scrolls on its own, since a full run reports dozens of lock variants
+  Widget reportBuild() {
+    return ListView(
+      children: <Widget>[
+        Text('Report', style: TextStyle(fontWeight: FontWeight.bold)),
+        Text('OS: ${report?['os-name']}'),
+        Text('GPU Name: ${report?['device-name']}'),
+        Text('GPU Type: ${report?['device-type']}'),
+        Text(
+            'Workgroups: ${report?['workgroups']} (requested ${report?['requested-workgroups']}, ${report?['occupancy']} co-resident${report?['occupancy-capped'] == true ? ', capped' : ''})'),
+        Text('Lock attempts per contender: ${report?['lock-iters']}'),
+        Text('Number of tests per lock: ${report?['test-iters']}'),
+        Text(
+            'Contention: ${report?['contention']} (${report?['contenders']} contenders)'),
+        Text('Total lock attempts per lock: ${report?['total-locks']}'),
+        Text('Pipeline cache hit: ${report?['pipeline-cache-hit']}'),
+        Text(
+            'Memory model: ${report?['capabilities']?['vulkan-memory-model']}, subgroup size: ${report?['capabilities']?['subgroup-size']}, shader clock: ${report?['capabilities']?['shader-device-clock']}'),
+        ...lockReportBuild(),
+        Text(
+            'Throughput ranking: ${(report?['throughput-ranking'] ?? []).join(' > ')}'),
+      ],
+    );
+  }
+
+  // One summary row per lock the last run reported, in run order, expanding to its details
+  List<Widget> lockReportBuild() {
+    final List<dynamic> locks = report?['locks'] ?? [];
+    return [
+      for (final name in locks)
+        ExpansionTile(
+          title: Text(
+              '${report?['$name-label']}: ${report?['$name-failure-percent']}% failures, ${report?['$name-acquisitions-per-second']} acquisitions/s'),
+          expandedCrossAxisAlignment: CrossAxisAlignment.start,
+          children: [
+            Text(
+                'Workgroups: ${report?['$name-workgroups']} (${report?['$name-occupancy']} co-resident on this lock\'s pipeline)'),
+            Text('Lock failures: ${report?['$name-failures']}'),
+            Text(
+                'Kernel time: ${report?['$name-kernel-time-mean-ms']} ms (stddev ${report?['$name-kernel-time-stddev-ms']} ms)'),
+            Text(
+                'Kernel time 95% CI: ${report?['$name-summary']?['kernel-time-ms']?['ci95-low']} to ${report?['$name-summary']?['kernel-time-ms']?['ci95-high']} ms'),
+            Text(
+                'Fairness: Jain ${report?['$name-fairness']?['jain-mean']}, CV ${report?['$name-fairness']?['cv-mean']}'),
+            Text(
+                'Retries per acquire: ${report?['$name-retries-per-acquire-mean']} average, ${report?['$name-retries-per-acquire-max']} max'),
+            if (report?['$name-latency'] != null)
+              Text(
+                  'Acquire latency: p50 ${report?['$name-latency']['p50-ticks']}, p90 ${report?['$name-latency']['p90-ticks']}, p99 ${report?['$name-latency']['p99-ticks']}, max ${report?['$name-latency']['max-ticks']} ticks'),
+          ],
+        ),
+    ];
+  }
+
   Widget logboxBuild(BuildContext context) {
     return Expanded(
       child: Center(